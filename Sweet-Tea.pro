@@ -1,4 +1,4 @@
-QT       += core gui xml network widgets concurrent
+QT       += core gui network widgets concurrent
 
 CONFIG += c++11
 
@@ -9,29 +9,71 @@ CONFIG += c++11
 DEFINES += QT_DEPRECATED_WARNINGS
 
 SOURCES += \
+    contenthash.cpp \
     errorwindow.cpp \
+    filedownload.cpp \
+    filereader.cpp \
+    filewatcher.cpp \
+    gamewatcher.cpp \
+    headlessupdate.cpp \
     launchprofileitemdelegate.cpp \
     main.cpp \
     mainwindow.cpp \
+    metrics.cpp \
     manifest.cpp \
+    manifestcache.cpp \
     manifestitem.cpp \
+    manifestloader.cpp \
+    mirrorscoreboard.cpp \
+    objectstore.cpp \
     optionswindow.cpp \
-    serverentry.cpp
+    packdownload.cpp \
+    progresstracker.cpp \
+    resourcecache.cpp \
+    segmenteddownload.cpp \
+    serverentry.cpp \
+    streamdecoder.cpp \
+    transferscheduler.cpp \
+    updater.cpp \
+    validationcache.cpp \
+    validationscheduler.cpp
 
 HEADERS += \
+    contenthash.h \
     errorwindow.h \
+    filedownload.h \
+    filereader.h \
+    filewatcher.h \
+    gamewatcher.h \
+    headlessupdate.h \
     launchprofileitemdelegate.h \
     mainwindow.h \
+    metrics.h \
     manifest.h \
+    manifestcache.h \
     manifestitem.h \
+    manifestloader.h \
+    mirrorscoreboard.h \
+    objectstore.h \
     optionswindow.h \
-    serverentry.h
+    packdownload.h \
+    progresstracker.h \
+    resourcecache.h \
+    segmenteddownload.h \
+    serverentry.h \
+    streamdecoder.h \
+    transferscheduler.h \
+    updater.h \
+    validationcache.h \
+    validationscheduler.h
 
 FORMS += \
     errorwindow.ui \
     mainwindow.ui \
     optionswindow.ui
 
+include(libraries.pri)
+
 RC_ICONS = icon.ico
 
 # Default rules for deployment.
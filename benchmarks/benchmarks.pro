@@ -0,0 +1,62 @@
+QT       += core network concurrent
+QT       -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = sweet-tea-benchmarks
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# The launcher's engine is built in, so the benchmarks
+# measure the same code the launcher runs.
+INCLUDEPATH += ..
+
+SOURCES += \
+    ../contenthash.cpp \
+    ../filedownload.cpp \
+    ../filereader.cpp \
+    ../filewatcher.cpp \
+    ../manifest.cpp \
+    ../manifestcache.cpp \
+    ../manifestitem.cpp \
+    ../metrics.cpp \
+    ../mirrorscoreboard.cpp \
+    ../objectstore.cpp \
+    ../packdownload.cpp \
+    ../progresstracker.cpp \
+    ../segmenteddownload.cpp \
+    ../serverentry.cpp \
+    ../streamdecoder.cpp \
+    ../transferscheduler.cpp \
+    ../updater.cpp \
+    ../validationcache.cpp \
+    ../validationscheduler.cpp \
+    httpstandin.cpp \
+    main.cpp \
+    manifestgenerator.cpp
+
+HEADERS += \
+    ../contenthash.h \
+    ../filedownload.h \
+    ../filereader.h \
+    ../filewatcher.h \
+    ../manifest.h \
+    ../manifestcache.h \
+    ../manifestitem.h \
+    ../metrics.h \
+    ../mirrorscoreboard.h \
+    ../objectstore.h \
+    ../packdownload.h \
+    ../progresstracker.h \
+    ../segmenteddownload.h \
+    ../serverentry.h \
+    ../streamdecoder.h \
+    ../transferscheduler.h \
+    ../updater.h \
+    ../validationcache.h \
+    ../validationscheduler.h \
+    httpstandin.h \
+    manifestgenerator.h
+
+include(../libraries.pri)
@@ -0,0 +1,300 @@
+#include "httpstandin.h"
+
+#include <QTcpSocket>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QFile>
+#include <QTimer>
+#include <QRandomGenerator>
+#include <QDebug>
+
+#include <algorithm>
+
+// How often throttled connections are topped up, in milliseconds.
+static const int TICK = 10;
+
+// Largest amount of data queued on a socket at once.
+static const qint64 CHUNK_SIZE = 1 << 20;
+
+static const QByteArray BOUNDARY = "sweet-tea-stand-in";
+
+/*
+ * One request on one connection. The connection is closed
+ * after the response, which is all the benchmarks need.
+ */
+class StandInResponse : public QObject
+{
+public:
+    StandInResponse(HttpStandIn *server, QTcpSocket *socket, const QString &root)
+        : QObject(socket),
+          server(server),
+          socket(socket),
+          root(root),
+          size(0),
+          remaining(0),
+          dropAt(-1),
+          answered(false) {
+
+        connect(socket, &QTcpSocket::readyRead, this, &StandInResponse::read);
+        connect(socket, &QTcpSocket::bytesWritten, this, [this] {
+            send(false);
+        });
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        connect(&timer, &QTimer::timeout, this, [this] {
+            send(true);
+        });
+
+    }
+
+private:
+    /*
+     * Part of the response body: a run of bytes from the
+     * file, or text of its own, such as a part's headers.
+     */
+    struct Piece {
+        QByteArray text;
+        qint64 start;
+        qint64 length;
+    };
+
+    // A range asked for, with the end inclusive.
+    struct Range {
+        qint64 start;
+        qint64 end;
+    };
+
+    HttpStandIn *server;
+    QTcpSocket *socket;
+    QString root;
+    QByteArray request;
+    QFile file;
+    qint64 size;
+    QList<Piece> pieces;
+    qint64 remaining;
+    qint64 dropAt;
+    bool answered;
+    QTimer timer;
+
+    void read() {
+
+        request.append(socket->readAll());
+        int end = request.indexOf("\r\n\r\n");
+        if(end < 0 || answered)
+            return;
+
+        answered = true;
+        server->requests++;
+        QTimer::singleShot(server->latency, this, [=] {
+            respond(request.left(end));
+        });
+
+    }
+
+    void respond(const QByteArray &head) {
+
+        QList<QByteArray> lines = head.split('\n');
+        QList<QByteArray> requestLine = lines.value(0).trimmed().split(' ');
+        QString path = QUrl::fromPercentEncoding(requestLine.value(1));
+
+        if(QRandomGenerator::global()->generateDouble() < server->errorRate) {
+            reply("503 Service Unavailable", {}, 0);
+            return;
+        }
+
+        file.setFileName(root + path);
+        if(path.contains("..") || !file.open(QIODevice::ReadOnly)) {
+            reply("404 Not Found", {}, 0);
+            return;
+        }
+
+        size = file.size();
+        QByteArray status = "200 OK";
+        QList<QByteArray> headers;
+        headers << "Accept-Ranges: bytes"
+                << "ETag: \"" + QByteArray::number(size) + "-"
+                   + QByteArray::number(QFileInfo(file).lastModified().toMSecsSinceEpoch()) + "\"";
+
+        QList<Range> ranges;
+        for(const QByteArray &line : lines) {
+            int colon = line.indexOf(':');
+            if(colon > 0 && line.left(colon).trimmed().toLower() == "range"
+                    && !parseRanges(line.mid(colon + 1).trimmed(), ranges)) {
+                reply("416 Range Not Satisfiable", {"Content-Range: bytes */" + QByteArray::number(size)}, 0);
+                return;
+            }
+        }
+        if(server->ranges == HttpStandIn::Ignored)
+            ranges.clear();
+        if(server->ranges == HttpStandIn::Merged && ranges.size() > 1) {
+            Range merged = ranges.first();
+            for(const Range &range : ranges) {
+                merged.start = qMin(merged.start, range.start);
+                merged.end = qMax(merged.end, range.end);
+            }
+            ranges = {merged};
+        }
+        if(server->ranges == HttpStandIn::Reversed)
+            std::reverse(ranges.begin(), ranges.end());
+
+        if(ranges.isEmpty()) {
+            pieces.append(Piece{QByteArray(), 0, size});
+        } else if(ranges.size() == 1) {
+            status = "206 Partial Content";
+            headers << "Content-Range: " + contentRange(ranges.first());
+            pieces.append(Piece{QByteArray(), ranges.first().start, ranges.first().end - ranges.first().start + 1});
+        } else {
+            status = "206 Partial Content";
+            headers << "Content-Type: multipart/byteranges; boundary=" + BOUNDARY;
+            for(const Range &range : ranges) {
+                QByteArray head = "\r\n--" + BOUNDARY + "\r\n"
+                        + "Content-Type: application/octet-stream\r\n"
+                        + "Content-Range: " + contentRange(range) + "\r\n\r\n";
+                pieces.append(Piece{head, 0, head.size()});
+                pieces.append(Piece{QByteArray(), range.start, range.end - range.start + 1});
+            }
+            QByteArray tail = "\r\n--" + BOUNDARY + "--\r\n";
+            pieces.append(Piece{tail, 0, tail.size()});
+        }
+
+        remaining = 0;
+        for(const Piece &piece : pieces)
+            remaining += piece.length;
+        if(QRandomGenerator::global()->generateDouble() < server->dropRate)
+            dropAt = remaining / 2;
+        reply(status, headers, remaining);
+
+        if(server->bandwidth > 0)
+            timer.start(TICK);
+        send(server->bandwidth > 0);
+
+    }
+
+    /*
+     * Read a Range header's value, such as "bytes=0-99,200-",
+     * clamping each range to the file. Ranges that start past
+     * the end make the whole header unsatisfiable.
+     */
+    bool parseRanges(const QByteArray &value, QList<Range> &ranges) {
+
+        if(!value.startsWith("bytes="))
+            return true;
+
+        for(const QByteArray &spec : value.mid(6).split(',')) {
+            int dash = spec.indexOf('-');
+            bool validStart = false;
+            bool validEnd = true;
+            qint64 start = spec.left(dash).trimmed().toLongLong(&validStart);
+            QByteArray last = spec.mid(dash + 1).trimmed();
+            qint64 end = last.isEmpty() ? size - 1 : last.toLongLong(&validEnd);
+            if(dash < 0 || !validStart || !validEnd || start > end || start >= size)
+                return false;
+            ranges.append(Range{start, qMin(end, size - 1)});
+        }
+        return true;
+
+    }
+
+    QByteArray contentRange(const Range &range) {
+        return "bytes " + QByteArray::number(range.start) + "-"
+                + QByteArray::number(range.end) + "/" + QByteArray::number(size);
+    }
+
+    void reply(const QByteArray &status, const QList<QByteArray> &headers, qint64 length) {
+
+        QByteArray head = "HTTP/1.1 " + status + "\r\n"
+                + "Content-Length: " + QByteArray::number(length) + "\r\n"
+                + "Connection: close\r\n";
+        for(const QByteArray &header : headers)
+            head += header + "\r\n";
+        socket->write(head + "\r\n");
+        if(length == 0)
+            socket->disconnectFromHost();
+
+    }
+
+    /*
+     * Queue the next part of the body, no more than the
+     * bandwidth allows for one tick when throttled.
+     * Throttled connections only send on ticks.
+     */
+    void send(bool tick) {
+
+        if(!file.isOpen() || remaining == 0)
+            return;
+
+        bool throttled = server->bandwidth > 0;
+        if(throttled != tick || (!throttled && socket->bytesToWrite() > CHUNK_SIZE))
+            return;
+
+        qint64 wanted = throttled ? qMax(server->bandwidth * TICK / 1000, qint64(1)) : CHUNK_SIZE;
+        QByteArray data;
+        while(!pieces.isEmpty() && data.size() < wanted) {
+            Piece &piece = pieces.first();
+            qint64 length = qMin(wanted - data.size(), piece.length);
+            if(piece.text.isEmpty()) {
+                file.seek(piece.start);
+                QByteArray read = file.read(length);
+                if(read.isEmpty()) {
+                    socket->abort();
+                    return;
+                }
+                data += read;
+                piece.start += read.size();
+                piece.length -= read.size();
+            } else {
+                data += piece.text.left(int(length));
+                piece.text.remove(0, int(length));
+                piece.length -= length;
+            }
+            if(piece.length == 0)
+                pieces.removeFirst();
+        }
+
+        remaining -= data.size();
+        server->bytesSent += data.size();
+        socket->write(data);
+
+        // Cut the response off, like a mirror that went away.
+        if(dropAt >= 0 && remaining <= dropAt) {
+            socket->flush();
+            socket->abort();
+            return;
+        }
+
+        if(remaining == 0) {
+            timer.stop();
+            file.close();
+            socket->disconnectFromHost();
+        }
+
+    }
+
+};
+
+HttpStandIn::HttpStandIn(const QString &root, QObject *parent)
+    : QObject(parent),
+      ranges(Multipart),
+      bandwidth(0),
+      latency(0),
+      errorRate(0),
+      dropRate(0),
+      requests(0),
+      bytesSent(0),
+      root(root) {
+
+    connect(&server, &QTcpServer::newConnection, this, &HttpStandIn::accept);
+
+}
+
+bool HttpStandIn::listen() {
+    return server.listen(QHostAddress::LocalHost);
+}
+
+QUrl HttpStandIn::url() {
+    return QUrl(QString("http://127.0.0.1:%1").arg(server.serverPort()));
+}
+
+void HttpStandIn::accept() {
+    while(QTcpSocket *socket = server.nextPendingConnection())
+        new StandInResponse(this, socket, root);
+}
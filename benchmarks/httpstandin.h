@@ -0,0 +1,57 @@
+#ifndef HTTPSTANDIN_H
+#define HTTPSTANDIN_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QUrl>
+
+/*
+ * A small HTTP server for the files in a directory, standing
+ * in for a mirror. It supports Range requests, including ones
+ * for several ranges, and can be slowed down or made to fail
+ * on purpose.
+ */
+class HttpStandIn : public QObject
+{
+    Q_OBJECT
+public:
+    /*
+     * How a request for several ranges is answered: with a
+     * multipart/byteranges response, with one range covering
+     * them all, with the parts in reverse order, or with the
+     * whole file, the way real servers do.
+     */
+    enum Ranges {
+        Multipart,
+        Merged,
+        Reversed,
+        Ignored
+    };
+
+    explicit HttpStandIn(const QString &root, QObject *parent = nullptr);
+    bool listen();
+    QUrl url();
+
+    Ranges ranges;
+
+    // Bytes per second for each connection, 0 for no limit.
+    qint64 bandwidth;
+    // Milliseconds to wait before each response.
+    int latency;
+    // Fraction of requests answered with an error status.
+    double errorRate;
+    // Fraction of responses cut off halfway through.
+    double dropRate;
+
+    qint64 requests;
+    qint64 bytesSent;
+
+private:
+    QString root;
+    QTcpServer server;
+
+    void accept();
+
+};
+
+#endif // HTTPSTANDIN_H
@@ -0,0 +1,594 @@
+#include "manifestgenerator.h"
+#include "httpstandin.h"
+#include "manifest.h"
+#include "manifestcache.h"
+#include "validationcache.h"
+#include "validationscheduler.h"
+#include "updater.h"
+
+#include <QtConcurrent>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCryptographicHash>
+#include <QNetworkAccessManager>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QStandardPaths>
+#include <QEventLoop>
+#include <QSettings>
+#include <QThread>
+#include <QBuffer>
+#include <QFileInfo>
+#include <QDir>
+#include <QDebug>
+
+#include <cstdio>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+/*
+ * Print the result of one benchmark as a line of JSON.
+ */
+static void report(const QString &benchmark, QJsonObject object) {
+    object.insert("benchmark", benchmark);
+    fprintf(stdout, "%s\n", QJsonDocument(object).toJson(QJsonDocument::Compact).constData());
+    fflush(stdout);
+}
+
+// Files in the segmented download test, and how much slower its slow mirror is.
+static const int SEGMENTED_FILES = 4;
+static const qint64 SLOW_MIRROR = 8;
+
+/*
+ * Files in the pack test no larger than this are packed. With
+ * parts out of order, only this many files are downloaded, so
+ * they're asked for in one request and the mirror only fails
+ * once before they fall back to their own URLs.
+ */
+static const qint64 PACK_THRESHOLD = 64 << 10;
+static const int REVERSED_FILES = 64;
+
+static qint64 perSecond(qint64 amount, qint64 nsecs) {
+    return nsecs > 0 ? qint64(double(amount) * 1e9 / nsecs) : 0;
+}
+
+/*
+ * The memory the process has resident, or -1 where
+ * that can't be found out.
+ */
+static qint64 residentBytes() {
+
+#ifdef Q_OS_LINUX
+    QFile statm("/proc/self/statm");
+    if(statm.open(QIODevice::ReadOnly))
+        return statm.readAll().split(' ').value(1).toLongLong() * sysconf(_SC_PAGESIZE);
+#endif
+    return -1;
+
+}
+
+/*
+ * Parse the manifest XML, then load it from the binary
+ * manifest cache, the way the launcher does on startup.
+ * How much memory a parsed manifest holds on to is
+ * measured first, before the allocator has free memory
+ * left over from other manifests to hand out.
+ */
+static void benchmarkParse(const QByteArray &xml, int iterations) {
+
+    QByteArray checksum = QCryptographicHash::hash(xml, QCryptographicHash::Md5);
+    qint64 resident = 0;
+    {
+        QBuffer buffer;
+        buffer.setData(xml);
+        buffer.open(QIODevice::ReadOnly);
+        qint64 before = residentBytes();
+        Manifest manifest(&buffer, checksum);
+        resident = before < 0 ? -1 : residentBytes() - before;
+    }
+
+    QElapsedTimer timer;
+    int files = 0;
+
+    timer.start();
+    for(int i = 0; i < iterations; i++) {
+        QBuffer buffer;
+        buffer.setData(xml);
+        buffer.open(QIODevice::ReadOnly);
+        Manifest manifest(&buffer, checksum);
+        files = manifest.items.size();
+        if(i == 0)
+            ManifestCache::save(&manifest);
+    }
+    qint64 parsed = timer.nsecsElapsed() / iterations;
+
+    timer.restart();
+    for(int i = 0; i < iterations; i++)
+        delete ManifestCache::load(checksum);
+    qint64 loaded = timer.nsecsElapsed() / iterations;
+
+    report("parse", {
+        {"files", files},
+        {"xmlBytes", xml.size()},
+        {"parseMs", parsed / 1e6},
+        {"filesPerSecond", perSecond(files, parsed)},
+        {"cachedLoadMs", loaded / 1e6},
+        {"residentBytes", resident},
+        {"residentBytesPerFile", resident >= 0 && files > 0 ? resident / files : -1}});
+
+}
+
+/*
+ * Validate every file through the validation scheduler and
+ * ManifestItem::validate, with the given cache and number of
+ * hashing threads, whatever kind of disk it is.
+ */
+static void benchmarkValidate(const QString &name, Manifest *manifest, ValidationCache *cache, bool force, int threads) {
+
+    QSettings settings;
+    settings.setValue("hashThreadsSsd", threads);
+    settings.setValue("hashThreadsHdd", threads);
+
+    ValidationScheduler validator(cache);
+    QEventLoop loop;
+    int remaining = manifest->items.size();
+    int invalid = 0;
+    QObject::connect (
+        &validator,
+        &ValidationScheduler::validated,
+        &loop,
+        [&](ManifestItem *, bool valid) {
+            if(!valid)
+                invalid++;
+            if(--remaining == 0)
+                loop.quit();
+        });
+
+    qint64 bytes = 0;
+    for(ManifestItem *item : manifest->items)
+        bytes += item->size;
+
+    QElapsedTimer timer;
+    timer.start();
+    validator.validate(manifest->items, force);
+    if(remaining > 0)
+        loop.exec();
+    qint64 elapsed = timer.nsecsElapsed();
+
+    report(name, {
+        {"threads", threads},
+        {"files", manifest->items.size()},
+        {"bytes", bytes},
+        {"invalid", invalid},
+        {"ms", elapsed / 1e6},
+        {"filesPerSecond", perSecond(manifest->items.size(), elapsed)},
+        {"bytesPerSecond", perSecond(bytes, elapsed)}});
+
+}
+
+/*
+ * Check a file the way the launcher did before FileReader,
+ * reading it through QFile.
+ */
+static bool validateWithQFile(const ManifestItem *item) {
+    QFile file(item->fname());
+    ContentHash hash(item->algorithm);
+    return file.size() == item->size
+            && file.open(QFile::ReadOnly)
+            && hash.addData(&file)
+            && hash.result() == item->digest();
+}
+
+/*
+ * Validate every file the way the launcher did before the
+ * validation scheduler, with one QtConcurrent::run and one
+ * QFutureWatcher per file on the global pool. Files are read
+ * through QFile, or through FileReader, so the scheduler and
+ * the read engine can each be compared to what they replaced.
+ */
+static void benchmarkValidatePerFile(const QString &name, Manifest *manifest, bool qfile) {
+
+    QEventLoop loop;
+    int remaining = manifest->items.size();
+    int invalid = 0;
+
+    qint64 bytes = 0;
+    for(ManifestItem *item : manifest->items)
+        bytes += item->size;
+
+    QElapsedTimer timer;
+    timer.start();
+    for(ManifestItem *item : manifest->items) {
+        QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(&loop);
+        QObject::connect(watcher, &QFutureWatcher<bool>::finished, [&, watcher] {
+            if(!watcher->result())
+                invalid++;
+            if(--remaining == 0)
+                loop.quit();
+        });
+        watcher->setFuture(QtConcurrent::run([=] {
+            return qfile ? validateWithQFile(item) : item->validate();
+        }));
+    }
+    if(remaining > 0)
+        loop.exec();
+    qint64 elapsed = timer.nsecsElapsed();
+
+    report(name, {
+        {"threads", QThreadPool::globalInstance()->maxThreadCount()},
+        {"files", manifest->items.size()},
+        {"bytes", bytes},
+        {"invalid", invalid},
+        {"ms", elapsed / 1e6},
+        {"filesPerSecond", perSecond(manifest->items.size(), elapsed)},
+        {"bytesPerSecond", perSecond(bytes, elapsed)}});
+
+}
+
+/*
+ * Update a manifest in the working directory through the
+ * same updater the launcher uses, forcing every file to be
+ * hashed, and return the files that failed.
+ */
+static QStringList update(Manifest *manifest, qint64 &elapsed) {
+
+    QNetworkAccessManager netMan;
+    Updater updater(&netMan);
+    QEventLoop loop;
+    QStringList errors;
+    QObject::connect (
+        &updater,
+        &Updater::finished,
+        &loop,
+        [&](const QStringList &failed) {
+            errors = failed;
+            loop.quit();
+        });
+
+    QElapsedTimer timer;
+    timer.start();
+    updater.update(manifest, true);
+    loop.exec();
+    elapsed = timer.nsecsElapsed();
+
+    // The manifest is saved on the pool, and mustn't go away before.
+    QThreadPool::globalInstance()->waitForDone();
+    return errors;
+
+}
+
+/*
+ * Download every file from the stand-in mirrors into
+ * an empty directory.
+ */
+static void benchmarkDownload(Manifest *manifest, QList<HttpStandIn*> mirrors) {
+
+    qint64 bytes = 0;
+    for(ManifestItem *item : manifest->items)
+        bytes += item->size;
+
+    qint64 elapsed = 0;
+    QStringList errors = update(manifest, elapsed);
+
+    qint64 requests = 0;
+    qint64 sent = 0;
+    for(HttpStandIn *mirror : mirrors) {
+        requests += mirror->requests;
+        sent += mirror->bytesSent;
+    }
+
+    report("download", {
+        {"files", manifest->items.size()},
+        {"bytes", bytes},
+        {"failed", errors.size()},
+        {"requests", requests},
+        {"bytesSent", sent},
+        {"ms", elapsed / 1e6},
+        {"bytesPerSecond", perSecond(bytes, elapsed)}});
+
+}
+
+/*
+ * Download a few large files split between three throttled
+ * mirrors, one of them far slower than the others. Every file
+ * has to arrive whole, and the slow mirror has to be left with
+ * less of the work than either fast one, or the test fails.
+ */
+static bool benchmarkSegmented(const QString &work, qint64 size, qint64 bandwidth) {
+
+    QString source = work + "/segmented-source";
+    QString target = work + "/segmented-target";
+    QDir(source).removeRecursively();
+    QDir(target).removeRecursively();
+    QDir().mkpath(source);
+    QDir().mkpath(target);
+
+    QList<HttpStandIn*> mirrors;
+    ManifestGenerator generator;
+    generator.files = SEGMENTED_FILES;
+    generator.size = size;
+    generator.distribution = ManifestGenerator::Fixed;
+    for(int i = 0; i < 3; i++) {
+        HttpStandIn *mirror = new HttpStandIn(source);
+        mirror->bandwidth = i == 0 ? qMax(bandwidth / SLOW_MIRROR, qint64(1)) : bandwidth;
+        mirrors.append(mirror);
+        if(!mirror->listen()) {
+            qCritical() << "unable to start a stand-in mirror";
+            qDeleteAll(mirrors);
+            return false;
+        }
+        generator.mirrors.append(mirror->url().toString());
+    }
+
+    QByteArray xml = generator.generate(source);
+    QBuffer buffer(&xml);
+    buffer.open(QIODevice::ReadOnly);
+    Manifest manifest(&buffer, QCryptographicHash::hash(xml, QCryptographicHash::Md5));
+
+    // The stand-ins share a host, which mustn't hold the mirrors back.
+    QSettings settings;
+    settings.setValue("segmentThreshold", size);
+    settings.setValue("hostDownloads", SEGMENTED_FILES * 3);
+    settings.remove("mirrors");
+
+    QString previous = QDir::currentPath();
+    QDir::setCurrent(target);
+    qint64 elapsed = 0;
+    QStringList errors = update(&manifest, elapsed);
+    QDir::setCurrent(previous);
+
+    settings.remove("segmentThreshold");
+    settings.remove("hostDownloads");
+
+    qint64 slow = mirrors[0]->bytesSent;
+    qint64 fast = qMin(mirrors[1]->bytesSent, mirrors[2]->bytesSent);
+    bool passed = errors.isEmpty() && slow < fast;
+    qint64 bytes = size * SEGMENTED_FILES;
+    report("download-segmented", {
+        {"files", manifest.items.size()},
+        {"bytes", bytes},
+        {"failed", errors.size()},
+        {"slowMirrorBytes", slow},
+        {"fastMirrorBytes", mirrors[1]->bytesSent + mirrors[2]->bytesSent},
+        {"ms", elapsed / 1e6},
+        {"bytesPerSecond", perSecond(bytes, elapsed)},
+        {"passed", passed}});
+
+    qDeleteAll(mirrors);
+    return passed;
+
+}
+
+/*
+ * Download the small files of an update from a pack, once for
+ * each way a mirror can answer a request for several ranges,
+ * and once from the files' own URLs to compare. Every other
+ * file is already in place, so the ones missing are scattered
+ * over the pack. Every file has to be whole afterwards, and a
+ * pack has to take fewer requests than there were files, or
+ * the test fails. Files can only come from the pack, except
+ * when the parts arrive out of order, which can't be unpacked,
+ * so they fall back to their own URLs.
+ */
+static bool benchmarkPacks(const QString &work, int files, qint64 size) {
+
+    struct Mode {
+        const char *name;
+        HttpStandIn::Ranges ranges;
+        bool packed;
+    };
+    const Mode modes[] = {
+        {"download-unpacked", HttpStandIn::Multipart, false},
+        {"download-pack-multipart", HttpStandIn::Multipart, true},
+        {"download-pack-merged", HttpStandIn::Merged, true},
+        {"download-pack-ignored", HttpStandIn::Ignored, true},
+        {"download-pack-reversed", HttpStandIn::Reversed, true}
+    };
+
+    QString source = work + "/pack-source";
+    QString target = work + "/pack-target";
+    QDir(source).removeRecursively();
+    QDir().mkpath(source);
+
+    HttpStandIn mirror(source);
+    if(!mirror.listen()) {
+        qCritical() << "unable to start a stand-in mirror";
+        return false;
+    }
+
+    ManifestGenerator generator;
+    generator.size = size;
+    generator.mirrors.append(mirror.url().toString());
+
+    QSettings settings;
+    bool passed = true;
+    for(const Mode &mode : modes) {
+
+        bool reversed = mode.ranges == HttpStandIn::Reversed;
+        generator.files = reversed ? qMin(files, REVERSED_FILES * 2) : files;
+        generator.packSize = mode.packed ? PACK_THRESHOLD : 0;
+        generator.packedUrls = !mode.packed || reversed;
+        QByteArray xml = generator.generate(source);
+        QBuffer buffer(&xml);
+        buffer.open(QIODevice::ReadOnly);
+        Manifest manifest(&buffer, QCryptographicHash::hash(xml, QCryptographicHash::Md5));
+
+        QDir(target).removeRecursively();
+        int missing = 0;
+        int packed = 0;
+        for(int i = 0; i < manifest.items.size(); i++) {
+            ManifestItem *item = manifest.items[i];
+            if(item->isPacked())
+                packed++;
+            if(i % 2 == 0) {
+                missing++;
+                continue;
+            }
+            QString fname = target + "/" + item->fname();
+            QDir().mkpath(QFileInfo(fname).path());
+            QFile::copy(source + "/" + item->fname(), fname);
+        }
+
+        mirror.ranges = mode.ranges;
+        mirror.requests = 0;
+        mirror.bytesSent = 0;
+        settings.remove("mirrors");
+
+        QString previous = QDir::currentPath();
+        QDir::setCurrent(target);
+        qint64 elapsed = 0;
+        QStringList errors = update(&manifest, elapsed);
+
+        // Check every file, rather than trusting the updater.
+        int invalid = 0;
+        for(ManifestItem *item : manifest.items)
+            if(!item->validate(nullptr, true))
+                invalid++;
+        QDir::setCurrent(previous);
+
+        bool ok = errors.isEmpty() && invalid == 0
+                && (generator.packedUrls || mirror.requests < missing);
+        passed = passed && ok;
+        report(mode.name, {
+            {"files", manifest.items.size()},
+            {"packed", packed},
+            {"missing", missing},
+            {"failed", errors.size()},
+            {"invalid", invalid},
+            {"requests", mirror.requests},
+            {"bytesSent", mirror.bytesSent},
+            {"ms", elapsed / 1e6},
+            {"filesPerSecond", perSecond(missing, elapsed)},
+            {"passed", ok}});
+
+    }
+
+    settings.remove("mirrors");
+    return passed;
+
+}
+
+int main(int argc, char *argv[])
+{
+
+    QCoreApplication a(argc, argv);
+
+    // Keep the benchmarks' settings and caches apart from the launcher's.
+    a.setApplicationName("Sweet Tea Benchmarks");
+    a.setOrganizationName("Thunderspy Gaming");
+    QStandardPaths::setTestModeEnabled(true);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOptions({
+        {"files", "Number of files to generate.", "count", "1000"},
+        {"size", "Typical file size in bytes.", "bytes", "65536"},
+        {"distribution", "File sizes: fixed, uniform or lognormal.", "name", "lognormal"},
+        {"hash", "Hash algorithm: md5, xxh3 or blake3.", "name", "md5"},
+        {"seed", "Seed for the generated files.", "number", "1"},
+        {"mirrors", "Number of stand-in mirrors.", "count", "1"},
+        {"bandwidth", "Bytes per second for each connection, 0 for no limit.", "bytes", "0"},
+        {"latency", "Milliseconds before each response.", "ms", "0"},
+        {"errors", "Fraction of requests that fail.", "rate", "0"},
+        {"drops", "Fraction of responses cut off halfway.", "rate", "0"},
+        {"iterations", "Number of times the manifest is parsed.", "count", "10"},
+        {"segmented-size", "Size of each file in the segmented download test.", "bytes", QString::number(16 << 20)},
+        {"segmented-bandwidth", "Bytes per second for each connection to the test's fast mirrors.", "bytes", QString::number(4 << 20)},
+        {"pack-files", "Number of files in the pack download test.", "count", "1000"},
+        {"pack-size", "Typical file size in the pack download test.", "bytes", "4096"},
+        {"threads", "Comma separated hashing thread counts to compare.", "counts", QString::number(QThread::idealThreadCount())},
+        {"workdir", "Directory to generate files in, instead of a temporary one.", "dir"}
+    });
+    parser.process(a);
+
+    QTemporaryDir temporary;
+    // Absolute, since the working directory changes between benchmarks.
+    QString work = QDir(parser.isSet("workdir") ? parser.value("workdir") : temporary.path()).absolutePath();
+    QString source = work + "/source";
+    QString target = work + "/target";
+    QDir(source).removeRecursively();
+    QDir(target).removeRecursively();
+    QDir().mkpath(source);
+    QDir().mkpath(target);
+
+    // Start every run with no mirror history.
+    QSettings().remove("mirrors");
+
+    QList<HttpStandIn*> mirrors;
+    ManifestGenerator generator;
+    for(int i = 0; i < qMax(parser.value("mirrors").toInt(), 1); i++) {
+        HttpStandIn *mirror = new HttpStandIn(source, &a);
+        mirror->bandwidth = parser.value("bandwidth").toLongLong();
+        mirror->latency = parser.value("latency").toInt();
+        mirror->errorRate = parser.value("errors").toDouble();
+        mirror->dropRate = parser.value("drops").toDouble();
+        if(!mirror->listen()) {
+            qCritical() << "unable to start a stand-in mirror";
+            return 1;
+        }
+        mirrors.append(mirror);
+        generator.mirrors.append(mirror->url().toString());
+    }
+
+    generator.files = parser.value("files").toInt();
+    generator.size = parser.value("size").toLongLong();
+    generator.seed = parser.value("seed").toUInt();
+    if(!ManifestGenerator::fromName(parser.value("distribution"), generator.distribution)
+            || !ContentHash::fromName(parser.value("hash"), generator.algorithm)
+            || !ContentHash::isSupported(generator.algorithm)) {
+        qCritical() << "unknown or unsupported distribution or hash";
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray xml = generator.generate(source);
+    report("generate", {
+        {"files", generator.files},
+        {"ms", timer.nsecsElapsed() / 1e6}});
+
+    benchmarkParse(xml, qMax(parser.value("iterations").toInt(), 1));
+
+    QBuffer buffer(&xml);
+    buffer.open(QIODevice::ReadOnly);
+    Manifest manifest(&buffer, QCryptographicHash::hash(xml, QCryptographicHash::Md5));
+
+    /*
+     * Manifest paths are relative to the working directory,
+     * like they are to the data directory in the launcher.
+     */
+    QDir::setCurrent(source);
+    ValidationCache cache(work + "/validation.cache");
+    for(const QString &count : parser.value("threads").split(',')) {
+        int threads = count.trimmed().toInt();
+        if(threads < 1)
+            continue;
+        ManifestGenerator::evict(source);
+        benchmarkValidate("validate-cold", &manifest, &cache, true, threads);
+        benchmarkValidate("validate-hot", &manifest, &cache, true, threads);
+        benchmarkValidate("validate-warm", &manifest, &cache, false, threads);
+    }
+    ManifestGenerator::evict(source);
+    benchmarkValidatePerFile("validate-cold-per-file-qfile", &manifest, true);
+    ManifestGenerator::evict(source);
+    benchmarkValidatePerFile("validate-cold-per-file", &manifest, false);
+
+    QDir::setCurrent(target);
+    benchmarkDownload(&manifest, mirrors);
+
+    bool passed = benchmarkSegmented (
+                work,
+                parser.value("segmented-size").toLongLong(),
+                parser.value("segmented-bandwidth").toLongLong() );
+    passed = benchmarkPacks (
+                work,
+                qMax(parser.value("pack-files").toInt(), 1),
+                parser.value("pack-size").toLongLong() ) && passed;
+
+    return passed ? 0 : 1;
+
+}
@@ -0,0 +1,160 @@
+#include "manifestgenerator.h"
+
+#include <QXmlStreamWriter>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+#include <cmath>
+#include <random>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// The pack small files are stored in, and where it's written under the root.
+static const char PACK_NAME[] = "small";
+static const char PACK_PATH[] = "packs/small.pack";
+
+/*
+ * Write the files under the root directory, and
+ * return the XML of a manifest listing them with a
+ * URL on every mirror.
+ */
+QByteArray ManifestGenerator::generate(const QString &root) {
+
+    std::mt19937_64 random(seed);
+    std::uniform_int_distribution<qint64> uniform(1, qMax(size * 2, qint64(1)));
+    std::lognormal_distribution<double> lognormal(std::log(double(qMax(size, qint64(1)))), 1.0);
+
+    QByteArray xml;
+    QXmlStreamWriter writer(&xml);
+    writer.setAutoFormatting(true);
+    writer.writeStartDocument();
+    writer.writeStartElement("manifest");
+    writer.writeAttribute("hash", ContentHash::name(algorithm));
+    writer.writeStartElement("filelist");
+
+    QFile pack(root + "/" + PACK_PATH);
+    qint64 packOffset = 0;
+    if(packSize > 0) {
+        QDir().mkpath(QFileInfo(pack).path());
+        if(!pack.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            qWarning() << "unable to write " << pack.fileName();
+    }
+
+    QByteArray buffer;
+    for(int i = 0; i < files; i++) {
+
+        qint64 length = size;
+        if(distribution == Uniform)
+            length = uniform(random);
+        else if(distribution == LogNormal)
+            length = qMax(qint64(lognormal(random)), qint64(1));
+
+        QString fname = QString("data/%1/file%2.bin")
+                .arg(i / qMax(filesPerDirectory, 1), 4, 10, QChar('0'))
+                .arg(i, 6, 10, QChar('0'));
+        QString path = root + "/" + fname;
+        QDir().mkpath(QFileInfo(path).path());
+
+        QFile file(path);
+        if(!file.open(QIODevice::WriteOnly)) {
+            qWarning() << "unable to write " << path;
+            continue;
+        }
+
+        bool packed = pack.isOpen() && length <= packSize;
+        ContentHash hash(algorithm);
+        for(qint64 written = 0; written < length; ) {
+            int chunk = int(qMin(length - written, qint64(1) << 20));
+            buffer.resize((chunk + 7) & ~7);
+            quint64 *words = reinterpret_cast<quint64*>(buffer.data());
+            for(int j = 0; j < buffer.size() / 8; j++)
+                words[j] = random();
+            file.write(buffer.constData(), chunk);
+            if(packed)
+                pack.write(buffer.constData(), chunk);
+            hash.addData(buffer.constData(), chunk);
+            written += chunk;
+        }
+
+        writer.writeStartElement("file");
+        writer.writeAttribute("name", fname);
+        writer.writeAttribute("size", QString::number(length));
+        writer.writeAttribute(ContentHash::name(algorithm), QString::fromLatin1(hash.result().toHex()));
+        if(packed) {
+            writer.writeAttribute("pack", PACK_NAME);
+            writer.writeAttribute("offset", QString::number(packOffset));
+            packOffset += length;
+        }
+        if(!packed || packedUrls)
+            for(const QString &mirror : mirrors)
+                writer.writeTextElement("url", mirror + "/" + fname);
+        writer.writeEndElement();
+
+    }
+
+    writer.writeEndElement();
+
+    if(pack.isOpen()) {
+        writer.writeStartElement("pack");
+        writer.writeAttribute("name", PACK_NAME);
+        for(const QString &mirror : mirrors)
+            writer.writeTextElement("url", mirror + "/" + PACK_PATH);
+        writer.writeEndElement();
+    }
+
+    writer.writeStartElement("profiles");
+    writer.writeStartElement("launch");
+    writer.writeAttribute("exec", "client");
+    writer.writeCharacters("Benchmark");
+    writer.writeEndElement();
+    writer.writeEndElement();
+    writer.writeEndElement();
+    writer.writeEndDocument();
+
+    return xml;
+
+}
+
+bool ManifestGenerator::fromName(const QString &name, Distribution &distribution) {
+
+    QString lower = name.trimmed().toLower();
+    if(lower == "fixed")
+        distribution = Fixed;
+    else if(lower == "uniform")
+        distribution = Uniform;
+    else if(lower == "lognormal")
+        distribution = LogNormal;
+    else
+        return false;
+
+    return true;
+
+}
+
+/*
+ * Drop the files from the page cache, so the next read
+ * comes from the disk. Only possible on unix.
+ */
+void ManifestGenerator::evict(const QString &root) {
+
+#ifdef Q_OS_UNIX
+    QDirIterator it(root, QDir::Files, QDirIterator::Subdirectories);
+    while(it.hasNext()) {
+        int fd = ::open(QFile::encodeName(it.next()).constData(), O_RDONLY);
+        if(fd < 0)
+            continue;
+        ::fdatasync(fd);
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    }
+#else
+    Q_UNUSED(root)
+#endif
+
+}
@@ -0,0 +1,43 @@
+#ifndef MANIFESTGENERATOR_H
+#define MANIFESTGENERATOR_H
+
+#include "contenthash.h"
+
+#include <QByteArray>
+#include <QStringList>
+
+/*
+ * Writes a tree of files with random contents and a
+ * manifest describing them. The same seed always gives
+ * the same tree, so runs can be compared. Small files
+ * can be put in a pack as well, under "packs".
+ */
+class ManifestGenerator
+{
+public:
+    enum Distribution {
+        Fixed,
+        Uniform,
+        LogNormal
+    };
+
+    int files = 1000;
+    qint64 size = 64 << 10;
+    Distribution distribution = LogNormal;
+    int filesPerDirectory = 100;
+    quint32 seed = 1;
+    ContentHash::Algorithm algorithm = ContentHash::Md5;
+    QStringList mirrors;
+    // Files no larger than this are also stored in a pack, 0 for none.
+    qint64 packSize = 0;
+    // Whether packed files keep URLs of their own to fall back on.
+    bool packedUrls = true;
+
+    QByteArray generate(const QString &root);
+
+    static bool fromName(const QString &name, Distribution &distribution);
+    static void evict(const QString &root);
+
+};
+
+#endif // MANIFESTGENERATOR_H
@@ -0,0 +1,174 @@
+#include "contenthash.h"
+#include "progresstracker.h"
+
+#ifdef HAVE_XXHASH
+#include <xxhash.h>
+#endif
+
+#ifdef HAVE_BLAKE3
+#include <blake3.h>
+#endif
+
+ContentHash::ContentHash(Algorithm algorithm)
+    : algorithm(algorithm),
+      md5(QCryptographicHash::Md5),
+      state(nullptr),
+      progress(nullptr) {
+
+    switch(algorithm) {
+#ifdef HAVE_XXHASH
+    case Xxh3:
+        state = XXH3_createState();
+        XXH3_64bits_reset(static_cast<XXH3_state_t*>(state));
+        break;
+#endif
+#ifdef HAVE_BLAKE3
+    case Blake3:
+        state = new blake3_hasher;
+        blake3_hasher_init(static_cast<blake3_hasher*>(state));
+        break;
+#endif
+    default:
+        break;
+    }
+
+}
+
+ContentHash::~ContentHash() {
+
+    switch(algorithm) {
+#ifdef HAVE_XXHASH
+    case Xxh3:
+        XXH3_freeState(static_cast<XXH3_state_t*>(state));
+        break;
+#endif
+#ifdef HAVE_BLAKE3
+    case Blake3:
+        delete static_cast<blake3_hasher*>(state);
+        break;
+#endif
+    default:
+        break;
+    }
+
+}
+
+void ContentHash::addData(const char *data, qint64 length) {
+
+    if(progress)
+        progress->addHashed(length);
+
+    switch(algorithm) {
+#ifdef HAVE_XXHASH
+    case Xxh3:
+        XXH3_64bits_update(static_cast<XXH3_state_t*>(state), data, size_t(length));
+        break;
+#endif
+#ifdef HAVE_BLAKE3
+    case Blake3:
+        blake3_hasher_update(static_cast<blake3_hasher*>(state), data, size_t(length));
+        break;
+#endif
+    default:
+        md5.addData(data, int(length));
+        break;
+    }
+
+}
+
+/*
+ * Count every byte hashed from now on as progress.
+ */
+void ContentHash::setProgress(ProgressTracker *progress) {
+    this->progress = progress;
+}
+
+/*
+ * Hash everything left to read from a device.
+ */
+bool ContentHash::addData(QIODevice *device) {
+
+    if(!device->isReadable())
+        return false;
+
+    QByteArray buffer(1 << 18, Qt::Uninitialized);
+    qint64 length;
+    while((length = device->read(buffer.data(), buffer.size())) > 0)
+        addData(buffer.constData(), length);
+
+    return length == 0;
+
+}
+
+/*
+ * The digest in the same byte order the
+ * reference command line tools print it in.
+ */
+QByteArray ContentHash::result() {
+
+    switch(algorithm) {
+#ifdef HAVE_XXHASH
+    case Xxh3: {
+        XXH64_canonical_t canonical;
+        XXH64_canonicalFromHash(&canonical, XXH3_64bits_digest(static_cast<XXH3_state_t*>(state)));
+        return QByteArray(reinterpret_cast<const char*>(canonical.digest), sizeof(canonical.digest));
+    }
+#endif
+#ifdef HAVE_BLAKE3
+    case Blake3: {
+        QByteArray digest(BLAKE3_OUT_LEN, Qt::Uninitialized);
+        blake3_hasher_finalize(static_cast<blake3_hasher*>(state),
+                               reinterpret_cast<uint8_t*>(digest.data()),
+                               BLAKE3_OUT_LEN);
+        return digest;
+    }
+#endif
+    default:
+        return md5.result();
+    }
+
+}
+
+bool ContentHash::fromName(const QString &name, Algorithm &algorithm) {
+
+    QString lower = name.trimmed().toLower();
+    if(lower.isEmpty() || lower == "md5")
+        algorithm = Md5;
+    else if(lower == "xxh3")
+        algorithm = Xxh3;
+    else if(lower == "blake3")
+        algorithm = Blake3;
+    else
+        return false;
+
+    return true;
+
+}
+
+QString ContentHash::name(Algorithm algorithm) {
+    switch(algorithm) {
+    case Xxh3:
+        return "xxh3";
+    case Blake3:
+        return "blake3";
+    default:
+        return "md5";
+    }
+}
+
+bool ContentHash::isSupported(Algorithm algorithm) {
+    switch(algorithm) {
+#ifdef HAVE_XXHASH
+    case Xxh3:
+        return true;
+#endif
+#ifdef HAVE_BLAKE3
+    case Blake3:
+        return true;
+#endif
+    case Md5:
+        return true;
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef CONTENTHASH_H
+#define CONTENTHASH_H
+
+#include <QCryptographicHash>
+#include <QIODevice>
+#include <QString>
+
+class ProgressTracker;
+
+/*
+ * Hashes file contents with one of the algorithms
+ * a manifest can declare. MD5 is always available,
+ * the others only when the library was found at
+ * build time.
+ */
+class ContentHash
+{
+public:
+    enum Algorithm : quint8 {
+        Md5,
+        Xxh3,
+        Blake3
+    };
+
+    explicit ContentHash(Algorithm algorithm);
+    ~ContentHash();
+    void addData(const char *data, qint64 length);
+    bool addData(QIODevice *device);
+    QByteArray result();
+    void setProgress(ProgressTracker *progress);
+
+    static bool fromName(const QString &name, Algorithm &algorithm);
+    static QString name(Algorithm algorithm);
+    static bool isSupported(Algorithm algorithm);
+
+private:
+    Q_DISABLE_COPY(ContentHash)
+
+    Algorithm algorithm;
+    QCryptographicHash md5;
+    void *state;
+    ProgressTracker *progress;
+
+};
+
+#endif // CONTENTHASH_H
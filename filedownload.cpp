@@ -0,0 +1,330 @@
+#include "filedownload.h"
+#include "filereader.h"
+#include "metrics.h"
+
+#include <QtConcurrent>
+#include <QNetworkRequest>
+#include <QFileInfo>
+#include <QSettings>
+#include <QDir>
+#include <QDebug>
+
+FileDownload::FileDownload (
+        ManifestItem *item,
+        QUrl url,
+        QNetworkAccessManager *netMan,
+        TransferScheduler *scheduler,
+        MirrorScoreboard *scores,
+        ProgressTracker *progress,
+        QObject *parent )
+    : QObject(parent),
+      item(item),
+      url(url),
+      netMan(netMan),
+      scheduler(scheduler),
+      scores(scores),
+      progress(progress),
+      part(item->fname() + ".part"),
+      reply(nullptr),
+      offset(0),
+      received(0),
+      latency(0),
+      began(0),
+      started(false),
+      failed(false),
+      cancelled(false),
+      local(false) {}
+
+/*
+ * Queue the download. It begins once the scheduler has
+ * room for another transfer. A partial file left by an
+ * earlier attempt is hashed first, on a pool thread, since
+ * the hash state can't be saved and the file may be large.
+ */
+void FileDownload::start() {
+
+    /*
+     * Compressed downloads always start over, since the
+     * decompressor's state can't be saved either. If-Range
+     * needs a validator to make the server send the whole file
+     * instead if it changed since.
+     */
+    {
+        QSettings meta(metaName(), QSettings::IniFormat);
+        validator = meta.value("etag").toString();
+        if(validator.isEmpty() || validator.startsWith("W/"))
+            validator = meta.value("lastModified").toString();
+    }
+
+    QString fname = part.fileName();
+    qint64 partial = QFileInfo(fname).size();
+    if(item->encoding != StreamDecoder::Identity || validator.isEmpty() || partial <= 0 || partial >= item->size) {
+        schedule();
+        return;
+    }
+
+    ContentHash *prefix = new ContentHash(item->algorithm);
+    QFutureWatcher<qint64> *watcher = new QFutureWatcher<qint64>(this);
+    connect(watcher, &QFutureWatcher<qint64>::finished, [=] {
+        watcher->deleteLater();
+        qint64 hashed = watcher->result();
+        if(hashed > 0 && hashed < item->size) {
+            hash.reset(prefix);
+            offset = hashed;
+        } else {
+            delete prefix;
+        }
+        schedule();
+    });
+    watcher->setFuture(QtConcurrent::run([=] {
+        qint64 size = QFileInfo(fname).size();
+        return FileReader::read(fname, *prefix) ? size : qint64(-1);
+    }));
+
+}
+
+void FileDownload::schedule() {
+    scheduler->request(url, this, [this] {
+        begin();
+    });
+}
+
+/*
+ * Give up on the download if it's still queued. One that
+ * already began runs to the end.
+ */
+void FileDownload::cancel() {
+    cancelled = true;
+}
+
+void FileDownload::begin() {
+
+    if(cancelled) {
+        scheduler->release(url);
+        emit finished(false);
+        return;
+    }
+
+    QFileInfo(item->fname()).dir().mkpath(".");
+    if(!part.open(QIODevice::ReadWrite)) {
+        qWarning() << "failed to write to " << part.fileName();
+        scheduler->release(url);
+        emit finished(false);
+        return;
+    }
+
+    QNetworkRequest req(url);
+    req.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    decoder.reset(new StreamDecoder(item->encoding));
+
+    // Resume the partial file, if it's still what was hashed.
+    if(offset > 0 && part.size() == offset && part.seek(offset)) {
+        progress->addDownloaded(offset);
+        req.setRawHeader("Range", "bytes=" + QByteArray::number(offset) + "-");
+        req.setRawHeader("If-Range", validator.toLatin1());
+        qInfo() << "resuming " << item->fname() << " at " << offset;
+    } else {
+        restart();
+    }
+
+    timer.start();
+    began = Metrics::now();
+    reply = netMan->get(req);
+    reply->setReadBufferSize(FileReader::BUFFER_SIZE);
+    connect (
+        reply,
+        &QNetworkReply::readyRead,
+        this,
+        &FileDownload::receive);
+    connect (
+        scheduler,
+        &TransferScheduler::refilled,
+        this,
+        &FileDownload::receive);
+    connect (
+        reply,
+        &QNetworkReply::finished,
+        this,
+        &FileDownload::complete);
+
+}
+
+/*
+ * Throw away anything already received and start
+ * the file over from the first byte.
+ */
+void FileDownload::restart() {
+    offset = 0;
+    received = 0;
+    part.resize(0);
+    part.seek(0);
+    hash.reset(new ContentHash(item->algorithm));
+    decoder.reset(new StreamDecoder(item->encoding));
+}
+
+/*
+ * Read as much as the bandwidth limit allows.
+ */
+void FileDownload::receive() {
+    if(reply->isFinished())
+        return;
+    write(reply->read(scheduler->take(reply->bytesAvailable())));
+}
+
+void FileDownload::write(const QByteArray &data) {
+
+    // Nothing arrived yet, or before the connection failed.
+    if(data.isEmpty())
+        return;
+
+    /*
+     * Check the response once, before the first bytes are written.
+     * Error pages are never written to the file, and a server that
+     * answers a range request with the whole file starts it over.
+     */
+    if(!started) {
+        started = true;
+        latency = timer.elapsed();
+        int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        failed = status >= 400;
+        QByteArray range = "bytes " + QByteArray::number(offset) + "-";
+        if(!failed && offset > 0 && (status != 206 || !reply->rawHeader("Content-Range").startsWith(range))) {
+            qInfo() << url << "can't resume, downloading " << item->fname() << " from the start";
+            restart();
+        }
+    }
+
+    if(failed)
+        return;
+
+    received += data.size();
+    QByteArray plain;
+    if(!decoder->decode(data, plain)) {
+        qWarning() << url << "sent data that can't be decompressed";
+        QFile::remove(metaName());
+        failed = true;
+        local = true;
+        reply->abort();
+        return;
+    }
+
+    // Don't let a bad or malicious mirror fill the disk.
+    if(part.size() + plain.size() > item->size) {
+        qWarning() << url << "sent more than " << item->size << " bytes";
+        QFile::remove(metaName());
+        failed = true;
+        reply->abort();
+        return;
+    }
+
+    hash->addData(plain.constData(), plain.size());
+    if(part.write(plain) != plain.size()) {
+        qWarning() << "failed to write to " << part.fileName();
+        QFile::remove(metaName());
+        failed = true;
+        local = true;
+        reply->abort();
+        return;
+    }
+    progress->addDownloaded(plain.size());
+
+}
+
+void FileDownload::complete() {
+
+    /*
+     * Whatever is still buffered is read regardless of the
+     * bandwidth limit, since the transfer is already over.
+     */
+    disconnect(scheduler, nullptr, this, nullptr);
+    write(reply->read(scheduler->take(reply->bytesAvailable(), true)));
+    reply->deleteLater();
+    scheduler->release(url);
+
+    Metrics::record("download", item->fname(), began, {
+        {"mirror", url.host()},
+        {"bytes", received},
+        {"offset", offset},
+        {"latencyMs", latency},
+        {"bytesPerSecond", received * 1000 / qMax(timer.elapsed(), qint64(1))},
+        {"error", reply->error() != QNetworkReply::NoError || failed}});
+
+    /*
+     * Failures on this end, such as a full disk or data the
+     * decoder can't handle, say nothing about the mirror.
+     */
+    if(reply->error() != QNetworkReply::NoError || failed) {
+        qWarning() << url << reply->errorString();
+        if(!local)
+            scores->recordFailure(url);
+        keepPartial();
+        emit finished(false);
+        return;
+    }
+
+    // Only replace the old file if the download is good.
+    if(part.size() != item->size || hash->result() != item->digest()) {
+        qWarning() << url << "does not match the manifest";
+        scores->recordFailure(url);
+        discardPartial();
+        emit finished(false);
+        return;
+    }
+
+    scores->recordSuccess(url, latency, received, timer.elapsed());
+
+    part.close();
+    QFile::remove(item->fname());
+    if(!part.rename(item->fname())) {
+        qWarning() << "failed to write to " << item->fname();
+        discardPartial();
+        emit finished(false);
+        return;
+    }
+
+    QFile::remove(metaName());
+    emit finished(true);
+
+}
+
+/*
+ * Remember how to resume the partial file. Without a
+ * validator the server can't be asked whether the file
+ * changed, so the partial file is useless and removed.
+ */
+void FileDownload::keepPartial() {
+
+    if(!started || failed || part.size() == 0) {
+        part.close();
+        return;
+    }
+
+    if(item->encoding != StreamDecoder::Identity) {
+        discardPartial();
+        return;
+    }
+
+    QByteArray etag = reply->rawHeader("ETag");
+    QByteArray lastModified = reply->rawHeader("Last-Modified");
+    if(etag.isEmpty() && lastModified.isEmpty()) {
+        discardPartial();
+        return;
+    }
+
+    part.close();
+    QSettings meta(metaName(), QSettings::IniFormat);
+    meta.setValue("url", url.toString());
+    meta.setValue("etag", QString::fromLatin1(etag));
+    meta.setValue("lastModified", QString::fromLatin1(lastModified));
+
+}
+
+void FileDownload::discardPartial() {
+    part.close();
+    part.remove();
+    QFile::remove(metaName());
+}
+
+QString FileDownload::metaName() {
+    return item->fname() + ".part.meta";
+}
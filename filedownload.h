@@ -0,0 +1,79 @@
+#ifndef FILEDOWNLOAD_H
+#define FILEDOWNLOAD_H
+
+#include "contenthash.h"
+#include "streamdecoder.h"
+#include "manifestitem.h"
+#include "mirrorscoreboard.h"
+#include "progresstracker.h"
+#include "transferscheduler.h"
+
+#include <QObject>
+#include <QFile>
+#include <QUrl>
+#include <QScopedPointer>
+#include <QElapsedTimer>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+
+/*
+ * Downloads a single manifest file from one URL. The file
+ * is written to a ".part" file next to it and hashed as it
+ * arrives, after decompressing it if the URL serves it
+ * compressed. If an uncompressed download is interrupted,
+ * the partial file is kept, and the next attempt resumes
+ * it with a range request when the server allows it.
+ */
+class FileDownload : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FileDownload (
+            ManifestItem *item,
+            QUrl url,
+            QNetworkAccessManager *netMan,
+            TransferScheduler *scheduler,
+            MirrorScoreboard *scores,
+            ProgressTracker *progress,
+            QObject *parent = nullptr );
+    void start();
+    void cancel();
+
+signals:
+    void finished(bool valid);
+
+private:
+    ManifestItem *item;
+    QUrl url;
+    QNetworkAccessManager *netMan;
+    TransferScheduler *scheduler;
+    MirrorScoreboard *scores;
+    ProgressTracker *progress;
+    QFile part;
+    QNetworkReply *reply;
+    QScopedPointer<ContentHash> hash;
+    QScopedPointer<StreamDecoder> decoder;
+    qint64 offset;
+    qint64 received;
+    qint64 latency;
+    QElapsedTimer timer;
+    qint64 began;
+    QString validator;
+    bool started;
+    bool failed;
+    bool cancelled;
+    bool local;
+
+    QString metaName();
+    void schedule();
+    void begin();
+    void restart();
+    void receive();
+    void write(const QByteArray &data);
+    void complete();
+    void keepPartial();
+    void discardPartial();
+
+};
+
+#endif // FILEDOWNLOAD_H
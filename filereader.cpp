@@ -0,0 +1,181 @@
+#include "filereader.h"
+
+#include <QFile>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+static const size_t BUFFER_ALIGNMENT = 4096;
+
+/*
+ * Hash the whole contents of a file.
+ */
+bool FileReader::read(const QString &fname, ContentHash &hash) {
+
+#ifdef Q_OS_UNIX
+    int fd = ::open(QFile::encodeName(fname).constData(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return false;
+
+    /*
+     * Validation reads each file once, start to end, so ask for
+     * aggressive readahead and keep the pages from pushing more
+     * useful data out of the cache.
+     */
+#ifdef Q_OS_LINUX
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+#endif
+
+    char *buffers[2];
+    buffers[0] = static_cast<char*>(qMallocAligned(BUFFER_SIZE * 2, BUFFER_ALIGNMENT));
+    if(!buffers[0]) {
+        qWarning() << "out of memory reading " << fname;
+        ::close(fd);
+        return false;
+    }
+    buffers[1] = buffers[0] + BUFFER_SIZE;
+
+#ifdef HAVE_LIBURING
+    bool ok = readRing(fd, hash, buffers);
+#else
+    bool ok = readBlocking(fd, 0, hash, buffers[0]);
+#endif
+
+    qFreeAligned(buffers[0]);
+    ::close(fd);
+    return ok;
+#else
+    QFile file(fname);
+    return file.open(QFile::ReadOnly | QFile::Unbuffered)
+            && hash.addData(&file);
+#endif
+
+}
+
+/*
+ * Read with plain pread calls, one buffer at a time.
+ */
+bool FileReader::readBlocking(int fd, qint64 offset, ContentHash &hash, char *buffer) {
+
+#ifdef Q_OS_UNIX
+    for(;;) {
+        ssize_t length = ::pread(fd, buffer, BUFFER_SIZE, offset);
+        if(length < 0 && errno == EINTR)
+            continue;
+        if(length < 0)
+            return false;
+        if(length == 0)
+            return true;
+        hash.addData(buffer, length);
+        offset += length;
+    }
+#else
+    Q_UNUSED(fd)
+    Q_UNUSED(offset)
+    Q_UNUSED(hash)
+    Q_UNUSED(buffer)
+    return false;
+#endif
+
+}
+
+#ifdef HAVE_LIBURING
+
+/*
+ * Every pool thread keeps its own ring, so
+ * rings are only set up once per thread.
+ */
+struct ReadRing {
+    io_uring ring;
+    bool ready;
+    ReadRing() { ready = io_uring_queue_init(2, &ring, 0) == 0; }
+    ~ReadRing() { if(ready) io_uring_queue_exit(&ring); }
+
+    /*
+     * Start over with an empty ring, so a read that was
+     * queued but never submitted can't be sent along with
+     * the next file's, after its buffer was freed.
+     */
+    void reset() {
+        if(ready)
+            io_uring_queue_exit(&ring);
+        ready = io_uring_queue_init(2, &ring, 0) == 0;
+    }
+};
+
+static bool submitRead(io_uring *ring, int fd, char *buffer, qint64 offset) {
+    io_uring_sqe *sqe = io_uring_get_sqe(ring);
+    if(!sqe)
+        return false;
+    io_uring_prep_read(sqe, fd, buffer, FileReader::BUFFER_SIZE, offset);
+    return io_uring_submit(ring) == 1;
+}
+
+static qint64 waitRead(io_uring *ring) {
+    io_uring_cqe *cqe;
+    int error;
+    while((error = io_uring_wait_cqe(ring, &cqe)) == -EINTR);
+    if(error < 0)
+        return error;
+    qint64 length = cqe->res;
+    io_uring_cqe_seen(ring, cqe);
+    return length;
+}
+
+#endif
+
+/*
+ * Read through io_uring, hashing one buffer while the
+ * next one is being filled. Falls back to blocking reads
+ * when the kernel can't set up a ring or doesn't support
+ * ring reads.
+ */
+bool FileReader::readRing(int fd, ContentHash &hash, char *buffers[2]) {
+
+#ifdef HAVE_LIBURING
+    static thread_local ReadRing reader;
+    if(!reader.ready)
+        return readBlocking(fd, 0, hash, buffers[0]);
+    if(!submitRead(&reader.ring, fd, buffers[0], 0)) {
+        reader.reset();
+        return readBlocking(fd, 0, hash, buffers[0]);
+    }
+
+    qint64 offset = 0;
+    for(int current = 0;; current ^= 1) {
+
+        qint64 length = waitRead(&reader.ring);
+        if(length < 0 && offset == 0) {
+            reader.reset();
+            return readBlocking(fd, 0, hash, buffers[0]);
+        }
+        if(length < 0) {
+            reader.reset();
+            return false;
+        }
+        if(length == 0)
+            return true;
+
+        offset += length;
+        if(!submitRead(&reader.ring, fd, buffers[current ^ 1], offset)) {
+            reader.reset();
+            hash.addData(buffers[current], length);
+            return readBlocking(fd, offset, hash, buffers[current ^ 1]);
+        }
+        hash.addData(buffers[current], length);
+
+    }
+#else
+    return readBlocking(fd, 0, hash, buffers[0]);
+#endif
+
+}
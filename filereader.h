@@ -0,0 +1,27 @@
+#ifndef FILEREADER_H
+#define FILEREADER_H
+
+#include "contenthash.h"
+
+#include <QString>
+
+/*
+ * Reads whole files for validation in large sequential
+ * chunks, with hints that tell the kernel the file is read
+ * once from start to end. On Linux, reads are overlapped
+ * with hashing through io_uring when it's available.
+ */
+class FileReader
+{
+public:
+    static const qint64 BUFFER_SIZE = 1 << 20;
+
+    static bool read(const QString &fname, ContentHash &hash);
+
+private:
+    static bool readBlocking(int fd, qint64 offset, ContentHash &hash, char *buffer);
+    static bool readRing(int fd, ContentHash &hash, char *buffers[2]);
+
+};
+
+#endif // FILEREADER_H
@@ -0,0 +1,222 @@
+#include "filewatcher.h"
+
+#include <QSocketNotifier>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QDir>
+#include <QDebug>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// Anything that can change what a file holds, or which file a path names.
+static const quint32 WATCH_EVENTS = IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE
+        | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+#endif
+
+FileWatcher::FileWatcher(QObject *parent)
+    : QObject(parent),
+      fd(-1),
+      notifier(nullptr),
+      watching(false),
+      lost(true) {}
+
+FileWatcher::~FileWatcher() {
+    close();
+}
+
+/*
+ * Start watching every directory under the given root,
+ * unless it's already watched. Until the paths touched
+ * so far are taken, they can't be trusted to be all.
+ */
+void FileWatcher::watch(const QString &root) {
+
+    QString path = QDir(root).canonicalPath();
+    if(watching && path == this->root)
+        return;
+
+    close();
+    this->root = path;
+    lost = true;
+
+#ifdef Q_OS_LINUX
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd < 0) {
+        qWarning() << "unable to watch the data directory";
+        return;
+    }
+    notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, &FileWatcher::readEvents);
+
+    watching = addDirectory(QString());
+    if(watching)
+        qInfo() << "watching " << directories.size() << " directories in " << path;
+    else
+        qWarning() << "unable to watch every directory in " << path << ", files will be checked on disk";
+#endif
+
+}
+
+/*
+ * Hand over the paths touched since they were last taken,
+ * relative to the root. Returns false if some may have been
+ * missed, in which case none of them can be trusted.
+ */
+bool FileWatcher::take(QSet<QString> &paths) {
+
+    readEvents();
+    paths.clear();
+    paths.swap(changed);
+
+    bool complete = watching && !lost;
+    lost = false;
+    return complete;
+
+}
+
+/*
+ * Forget that a file was touched, once it's been written
+ * by the launcher itself. Its events are queued as soon as
+ * it's written, so reading them first means none of them
+ * turn up afterwards.
+ */
+void FileWatcher::ignore(const QString &fname) {
+    readEvents();
+    changed.remove(QDir::cleanPath(fname));
+}
+
+/*
+ * Check whether a file, or any directory above it, is
+ * among the touched paths. Paths outside the root can't
+ * have been watched, so they always count as touched.
+ */
+bool FileWatcher::touched(const QSet<QString> &paths, const QString &fname) {
+
+    QString path = QDir::cleanPath(fname);
+    if(QDir::isAbsolutePath(path) || path == ".." || path.startsWith("../"))
+        return true;
+
+    for(;;) {
+        if(paths.contains(path))
+            return true;
+        int slash = path.lastIndexOf('/');
+        if(slash < 0)
+            return false;
+        path.truncate(slash);
+    }
+
+}
+
+/*
+ * Watch a directory and every one under it. Directories
+ * reached through symbolic links aren't followed, since
+ * their files could change under another name, so they
+ * make the watch incomplete.
+ */
+bool FileWatcher::addDirectory(const QString &path) {
+
+#ifdef Q_OS_LINUX
+    QString absolute = path.isEmpty() ? root : root + "/" + path;
+    int wd = inotify_add_watch(fd, QFile::encodeName(absolute).constData(), WATCH_EVENTS);
+    if(wd < 0)
+        return false;
+    directories.insert(wd, path);
+
+    bool complete = true;
+    QDirIterator it(absolute, QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+    while(it.hasNext()) {
+        it.next();
+        if(it.fileInfo().isSymLink()) {
+            complete = false;
+            continue;
+        }
+        QString name = path.isEmpty() ? it.fileName() : path + "/" + it.fileName();
+        complete = addDirectory(name) && complete;
+    }
+    return complete;
+#else
+    Q_UNUSED(path)
+    return false;
+#endif
+
+}
+
+void FileWatcher::readEvents() {
+
+#ifdef Q_OS_LINUX
+    if(fd < 0)
+        return;
+
+    alignas(struct inotify_event) char buffer[16384];
+    for(;;) {
+        ssize_t length = ::read(fd, buffer, sizeof(buffer));
+        if(length <= 0)
+            break;
+
+        for(char *p = buffer; p < buffer + length; ) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            // The kernel's queue filled up and events were dropped.
+            if(event->mask & IN_Q_OVERFLOW) {
+                lost = true;
+                continue;
+            }
+
+            auto dir = directories.constFind(event->wd);
+            if(dir == directories.constEnd())
+                continue;
+
+            if(event->mask & IN_IGNORED) {
+                directories.erase(dir);
+                continue;
+            }
+
+            /*
+             * The directory itself went away or moved. Its parent
+             * already recorded that, unless it was the root.
+             */
+            if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                if(dir.value().isEmpty())
+                    watching = false;
+                continue;
+            }
+
+            if(event->len == 0)
+                continue;
+
+            QString name = QFile::decodeName(event->name);
+            if(!dir.value().isEmpty())
+                name = dir.value() + "/" + name;
+            changed.insert(name);
+
+            /*
+             * A new directory is recorded as a whole, since files may
+             * appear in it before it's watched, and is watched from now.
+             */
+            if((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                if(!addDirectory(name))
+                    watching = false;
+            }
+        }
+    }
+#endif
+
+}
+
+void FileWatcher::close() {
+
+    delete notifier;
+    notifier = nullptr;
+#ifdef Q_OS_LINUX
+    if(fd >= 0)
+        ::close(fd);
+#endif
+    fd = -1;
+    directories.clear();
+    changed.clear();
+    watching = false;
+
+}
@@ -0,0 +1,45 @@
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QString>
+
+class QSocketNotifier;
+
+/*
+ * Watches the data directory while the launcher runs and
+ * records which paths in it were touched, so a file that
+ * nothing touched since it was validated can be trusted
+ * without looking at it again. Only Linux is supported;
+ * elsewhere nothing is ever watched.
+ */
+class FileWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FileWatcher(QObject *parent = nullptr);
+    ~FileWatcher();
+    void watch(const QString &root);
+    bool take(QSet<QString> &paths);
+    void ignore(const QString &fname);
+
+    static bool touched(const QSet<QString> &paths, const QString &fname);
+
+private:
+    QString root;
+    int fd;
+    QSocketNotifier *notifier;
+    QHash<int, QString> directories;
+    QSet<QString> changed;
+    bool watching;
+    bool lost;
+
+    bool addDirectory(const QString &path);
+    void readEvents();
+    void close();
+
+};
+
+#endif // FILEWATCHER_H
@@ -0,0 +1,93 @@
+#include "gamewatcher.h"
+
+#include <QDebug>
+
+#ifdef Q_OS_WIN
+#include <qt_windows.h>
+#elif defined(Q_OS_UNIX)
+#include <signal.h>
+#include <cerrno>
+#endif
+
+// How often the games are checked on, in milliseconds.
+static const int POLL_INTERVAL = 2000;
+
+GameWatcher::GameWatcher(QObject *parent)
+    : QObject(parent) {
+
+    timer.setInterval(POLL_INTERVAL);
+    connect(&timer, &QTimer::timeout, this, &GameWatcher::poll);
+
+}
+
+GameWatcher::~GameWatcher() {
+    for(const Game &game : games)
+        release(game);
+}
+
+/*
+ * Start keeping track of a game that was just started.
+ */
+void GameWatcher::watch(qint64 pid) {
+
+    Game game;
+    game.pid = pid;
+    game.handle = nullptr;
+#ifdef Q_OS_WIN
+    // The handle keeps the process ID from being reused.
+    game.handle = OpenProcess(SYNCHRONIZE, FALSE, DWORD(pid));
+    if(!game.handle)
+        return;
+#endif
+
+    bool wasRunning = isRunning();
+    games.append(game);
+    timer.start();
+    qInfo() << "game started, pid " << pid;
+    if(!wasRunning)
+        emit runningChanged(true);
+
+}
+
+bool GameWatcher::isRunning() const {
+    return !games.isEmpty();
+}
+
+void GameWatcher::poll() {
+
+    for(int i = games.size() - 1; i >= 0; i--) {
+        if(isAlive(games[i]))
+            continue;
+        qInfo() << "game exited, pid " << games[i].pid;
+        release(games[i]);
+        games.removeAt(i);
+    }
+
+    if(games.isEmpty()) {
+        timer.stop();
+        emit runningChanged(false);
+    }
+
+}
+
+bool GameWatcher::isAlive(const Game &game) {
+
+#ifdef Q_OS_WIN
+    return WaitForSingleObject(static_cast<HANDLE>(game.handle), 0) == WAIT_TIMEOUT;
+#elif defined(Q_OS_UNIX)
+    // A process that can't be signalled still exists.
+    return ::kill(pid_t(game.pid), 0) == 0 || errno == EPERM;
+#else
+    Q_UNUSED(game)
+    return false;
+#endif
+
+}
+
+void GameWatcher::release(const Game &game) {
+#ifdef Q_OS_WIN
+    CloseHandle(static_cast<HANDLE>(game.handle));
+#else
+    Q_UNUSED(game)
+#endif
+}
@@ -0,0 +1,40 @@
+#ifndef GAMEWATCHER_H
+#define GAMEWATCHER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QList>
+
+/*
+ * Keeps track of the games started from the launcher, which
+ * are detached so they outlive it, by checking now and then
+ * whether their processes are still there.
+ */
+class GameWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit GameWatcher(QObject *parent = nullptr);
+    ~GameWatcher();
+    void watch(qint64 pid);
+    bool isRunning() const;
+
+signals:
+    void runningChanged(bool running);
+
+private:
+    struct Game {
+        qint64 pid;
+        void *handle;
+    };
+
+    QList<Game> games;
+    QTimer timer;
+
+    void poll();
+    static bool isAlive(const Game &game);
+    static void release(const Game &game);
+
+};
+
+#endif // GAMEWATCHER_H
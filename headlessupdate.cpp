@@ -0,0 +1,139 @@
+#include "headlessupdate.h"
+
+#include <QJsonDocument>
+#include <QDebug>
+
+#include <cstdio>
+
+// Progress is printed at most this often, in milliseconds.
+static const int REPORT_INTERVAL = 500;
+
+HeadlessUpdate::HeadlessUpdate(const QStringList &manifests, bool force, QObject *parent)
+    : QObject(parent),
+      loader(&netMan),
+      updater(&netMan),
+      locations(manifests),
+      force(force),
+      pending(0),
+      status(Success),
+      current(nullptr) {
+
+    output.open(stdout, QIODevice::WriteOnly);
+    updater.progress.setInterval(REPORT_INTERVAL);
+
+    connect (
+        &loader,
+        &ManifestLoader::loaded,
+        [this](Manifest *manifest) {
+            manifests.enqueue(manifest);
+            if(--pending == 0)
+                next();
+        });
+
+    connect (
+        &loader,
+        &ManifestLoader::failed,
+        [this](const QString &location, const QString &error) {
+            report("error", {{"manifest", location}, {"message", error}});
+            status = qMax(status, int(ManifestFailed));
+            if(--pending == 0)
+                next();
+        });
+
+    connect (
+        &updater.progress,
+        &ProgressTracker::updated,
+        this,
+        &HeadlessUpdate::progress);
+
+    connect (
+        &updater,
+        &Updater::finished,
+        [this](const QStringList &errors) {
+            for(const QString &error : errors)
+                report("error", {{"message", error}});
+            if(!errors.isEmpty())
+                status = qMax(status, int(FilesFailed));
+            next();
+        });
+
+}
+
+/*
+ * Load every manifest first, then update them one at a
+ * time, since they may share files in the data directory.
+ */
+void HeadlessUpdate::start() {
+
+    locations.removeAll(QString());
+    pending = locations.size();
+    if(pending == 0) {
+        report("error", {{"message", "no manifests configured"}});
+        status = ManifestFailed;
+        next();
+        return;
+    }
+
+    for(const QString &location : locations)
+        loader.load(location);
+
+}
+
+void HeadlessUpdate::next() {
+
+    if(manifests.isEmpty()) {
+        report("finished", {{"status", status}});
+        emit finished(status);
+        return;
+    }
+
+    current = manifests.dequeue();
+
+    qint64 total = 0;
+    for(ManifestItem *item : current->items)
+        total += item->size;
+    report("manifest", {
+        {"checksum", QString::fromLatin1(current->checksum.toHex())},
+        {"files", current->items.size()},
+        {"bytes", total}});
+
+    /*
+     * There's no one to ask, so files the manifest
+     * marks for deletion are simply deleted.
+     */
+    for(const QString &fname : current->deletions) {
+        if(QFile::exists(fname) && QFile::remove(fname))
+            report("deleted", {{"file", fname}});
+    }
+
+    updater.update(current, force);
+
+}
+
+/*
+ * Print how far the current manifest got, in files and
+ * in bytes hashed or downloaded, and the recent speed.
+ */
+void HeadlessUpdate::progress(const ProgressTracker::Snapshot &snapshot) {
+
+    report("progress", {
+        {"files", snapshot.files},
+        {"totalFiles", snapshot.totalFiles},
+        {"failedFiles", updater.errorFiles.size()},
+        {"hashedBytes", snapshot.hashed},
+        {"downloadedBytes", snapshot.downloaded},
+        {"bytes", snapshot.done},
+        {"totalBytes", snapshot.total},
+        {"bytesPerSecond", snapshot.bytesPerSecond},
+        {"etaSeconds", snapshot.eta}});
+
+}
+
+void HeadlessUpdate::report(const QString &event, QJsonObject object) {
+
+    object.insert("event", event);
+    output.write(QJsonDocument(object).toJson(QJsonDocument::Compact));
+    output.write("\n");
+    output.flush();
+
+}
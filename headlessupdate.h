@@ -0,0 +1,54 @@
+#ifndef HEADLESSUPDATE_H
+#define HEADLESSUPDATE_H
+
+#include "manifest.h"
+#include "manifestloader.h"
+#include "updater.h"
+
+#include <QObject>
+#include <QNetworkAccessManager>
+#include <QJsonObject>
+#include <QQueue>
+#include <QFile>
+
+/*
+ * Validates and repairs every given manifest without a
+ * display, printing progress to standard output as one
+ * JSON object per line.
+ */
+class HeadlessUpdate : public QObject
+{
+    Q_OBJECT
+public:
+    explicit HeadlessUpdate(const QStringList &manifests, bool force, QObject *parent = nullptr);
+    void start();
+
+    // Exit statuses, the worst one wins.
+    enum Status {
+        Success = 0,
+        FilesFailed = 1,
+        ManifestFailed = 2
+    };
+
+signals:
+    void finished(int status);
+
+private:
+    QNetworkAccessManager netMan;
+    ManifestLoader loader;
+    Updater updater;
+    QStringList locations;
+    bool force;
+    int pending;
+    int status;
+    QQueue<Manifest*> manifests;
+    Manifest *current;
+    QFile output;
+
+    void next();
+    void progress(const ProgressTracker::Snapshot &snapshot);
+    void report(const QString &event, QJsonObject object);
+
+};
+
+#endif // HEADLESSUPDATE_H
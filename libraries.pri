@@ -0,0 +1,34 @@
+# Optional libraries, shared by the launcher and the benchmarks.
+
+# Faster hash algorithms manifests can use instead of MD5.
+unix {
+    CONFIG += link_pkgconfig
+    packagesExist(libxxhash) {
+        PKGCONFIG += libxxhash
+        DEFINES += HAVE_XXHASH
+    }
+    packagesExist(libblake3) {
+        PKGCONFIG += libblake3
+        DEFINES += HAVE_BLAKE3
+    }
+}
+
+# Compressed downloads.
+unix {
+    packagesExist(zlib) {
+        PKGCONFIG += zlib
+        DEFINES += HAVE_ZLIB
+    }
+    packagesExist(libzstd) {
+        PKGCONFIG += libzstd
+        DEFINES += HAVE_ZSTD
+    }
+}
+
+# Overlapped file reads during validation.
+linux {
+    packagesExist(liburing) {
+        PKGCONFIG += liburing
+        DEFINES += HAVE_LIBURING
+    }
+}
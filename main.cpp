@@ -1,38 +1,85 @@
 #include "mainwindow.h"
 #include "manifest.h"
+#include "headlessupdate.h"
+#include "metrics.h"
 
 #include <QtDebug>
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QTimer>
+#include <QDir>
 
 int main(int argc, char *argv[])
 {
 
-    QApplication a(argc, argv);
+    /*
+     * Headless mode has to run without a display,
+     * so it can't create the widget application.
+     */
+    bool headless = false;
+    for(int i = 1; i < argc; i++)
+        if(qstrcmp(argv[i], "--headless") == 0)
+            headless = true;
+    QScopedPointer<QCoreApplication> a (
+                headless
+                ? new QCoreApplication(argc, argv)
+                : new QApplication(argc, argv) );
 
-    a.setApplicationName("Sweet Tea");
-    a.setOrganizationName("Thunderspy Gaming");
+    a->setApplicationName("Sweet Tea");
+    a->setOrganizationName("Thunderspy Gaming");
+    Metrics::start();
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOptions({
+        {"headless", "Validate and repair the manifests without a window, then exit."},
+        {"datadir", "Install the files into <dir> instead of the configured one.", "dir"},
+        {"manifest", "Use <location> instead of the configured manifests. Repeatable.", "location"},
+        {"force", "Hash every file again, even if it hasn't changed."}
+    });
+    parser.process(*a);
 
     /*
      * Attempt to change the working directory
      * to the one in the one in the configurations.
      */
     QSettings settings;
-    QString datadir = settings.value (
+    QString datadir = parser.isSet("datadir") ? parser.value("datadir") : settings.value (
                 "datadir",
                 QStandardPaths::writableLocation(QStandardPaths::DataLocation)
                 ).toString();
     if(!QDir::setCurrent(datadir)) {
         qWarning() << "unable to access: " + datadir;
-        if(QDir(datadir).mkpath(".") && QDir::setCurrent(datadir))
-            settings.remove("oldDir");
-        else
+        if(!QDir(datadir).mkpath(".") || !QDir::setCurrent(datadir))
             qWarning() << "unable to create: " + datadir;
     }
 
+    /*
+     * Update the manifests and exit with a status
+     * code, printing JSON progress for scripts.
+     */
+    if(headless) {
+        QStringList manifests = parser.values("manifest");
+        if(manifests.isEmpty())
+            manifests = settings.value("manifests").toString().split(" ");
+        bool force = parser.isSet("force") || settings.value("forceRehash", false).toBool();
+
+        HeadlessUpdate update(manifests, force);
+        QObject::connect(&update, &HeadlessUpdate::finished, a.data(), &QCoreApplication::exit);
+        QTimer::singleShot(0, &update, &HeadlessUpdate::start);
+        int status = a->exec();
+        Metrics::stop();
+        return status;
+    }
+
     // Show the main window.
     MainWindow w;
     w.show();
 
-    return a.exec();
+    int status = a->exec();
+    Metrics::stop();
+    return status;
 
 }
@@ -9,12 +9,20 @@
 #include <QMessageBox>
 #include <QProgressDialog>
 #include <QDesktopServices>
+#include <QSettings>
+
+// Steps in the progress bar, so it moves smoothly.
+static const int PROGRESS_STEPS = 1000;
 
 // FIXME: Don't put so much in the main window.
 MainWindow::MainWindow (
         QWidget *parent )
     : QMainWindow(parent)
-    , ui(new Ui::MainWindow) {
+    , ui(new Ui::MainWindow)
+    , manifest(nullptr)
+    , validating(nullptr)
+    , loader(&netMan)
+    , updater(&netMan) {
 
     setup();
 
@@ -26,6 +34,62 @@ void MainWindow::setup() {
     ui->listWidget->setSelectionMode(QAbstractItemView::SingleSelection);
     ui->listWidget->setItemDelegate(new LaunchProfileItemDelegate);
 
+    // Note which files are touched while the launcher stays open.
+    updater.watch(QDir::currentPath());
+
+    /*
+     * Add the launch profiles (server entries) of
+     * each manifest to the list once it's parsed, and
+     * update it in the background if that's enabled.
+     */
+    connect (
+        &loader,
+        &ManifestLoader::loaded,
+        [this](Manifest *manifest) {
+            for(ServerEntry *server : manifest->servers)
+                addServerEntry(server);
+            if(QSettings().value("backgroundUpdate", false).toBool())
+                updater.prefetch(manifest);
+        });
+
+    /*
+     * A profile that was updated in the background
+     * can be launched without validating it again.
+     */
+    connect (
+        &updater,
+        &Updater::prefetched,
+        [this](Manifest *manifest, bool valid) {
+            if(valid && manifest == this->manifest && !validating) {
+                ui->UpdateProgress->setValue(PROGRESS_STEPS);
+                ui->LaunchButton->setEnabled(true);
+            }
+        });
+
+    // Background updates keep out of the way while a game runs.
+    connect (
+        &games,
+        &GameWatcher::runningChanged,
+        [this](bool running) {
+            updater.setPaused(running);
+        });
+
+    /*
+     * Show validation and download progress by bytes, a few
+     * times a second, and the files that failed once it's done.
+     */
+    ui->UpdateProgress->setMaximum(PROGRESS_STEPS);
+    connect (
+        &updater.progress,
+        &ProgressTracker::updated,
+        this,
+        &MainWindow::showProgress);
+    connect (
+        &updater,
+        &Updater::finished,
+        this,
+        &MainWindow::finishValidation);
+
     loadManifests();
 
     /*
@@ -52,6 +116,8 @@ void MainWindow::setup() {
             w->show();
             connect(w, &QDialog::finished, [this] {
                 ui->OptionsButton->setEnabled(true);
+                updater.configure();
+                updater.watch(QDir::currentPath());
                 loadManifests();
             });
         });
@@ -76,10 +142,11 @@ void MainWindow::setup() {
         ui->LaunchButton,
         &QPushButton::released,
         [this] {
-            QProcess *proc = new QProcess(this);
             QListWidgetItem *item = ui->listWidget->currentItem();
             ServerEntry *server = item->data(Qt::UserRole + 1).value<ServerEntry*>();
-            proc->startDetached(server->client, server->args.split(" "));
+            qint64 pid;
+            if(QProcess::startDetached(server->client, server->args.split(" "), QString(), &pid))
+                games.watch(pid);
         });
 
     /*
@@ -97,117 +164,68 @@ void MainWindow::setup() {
 /*
  * Ask the user for permission before deleting a file.
  */
-void MainWindow::deleteItem(QString *item) {
+void MainWindow::deleteItem(const QString &item) {
 
-    QFile file(*item);
+    QFile file(item);
     if(!file.exists()) {
-        qInfo() << *item << " does not exist, so not deleting";
+        qInfo() << item << " does not exist, so not deleting";
         return;
     }
 
-    QMessageBox::StandardButton choice = QMessageBox::question(this, "Delete File", "Delete " + *item);
+    QMessageBox::StandardButton choice = QMessageBox::question(this, "Delete File", "Delete " + item);
     if(choice == QMessageBox::Yes)
         if(!file.remove())
-            QMessageBox::warning(this, "File Delete Error", "Unable to delete " + *item);
+            QMessageBox::warning(this, "File Delete Error", "Unable to delete " + item);
 
 }
 
-/*
- * Download and/or validate a file in the given manifest.
- * FIXME: A LOT of code dupe.
- */
-void MainWindow::downloadItem(ManifestItem *item) {
-
-    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
-    QFuture<bool> future = QtConcurrent::run([item]{
-        return item->validate();
-    });
-
-    connect(watcher, &QFutureWatcher<bool>::finished, [=] {
-
-        if(future.result()) {
-            qInfo() << item->fname + " validated";
-            currentFiles++;
-            ui->UpdateProgress->setValue(currentFiles);
-            if(currentFiles + errorFiles.length() >= maxFiles) {
-                qInfo() << "last file";
-                if(errorFiles.length() <= 0) {
-                    QSettings settings;
-                    settings.setValue("manifestChecksum", manifest->checksum);
-                    settings.setValue("oldDir", QDir::currentPath());
-                    qInfo() << QDir::currentPath();
-                    qInfo() << settings.value("oldDir").toString();
-                    ui->LaunchButton->setEnabled(true);
-                } else {
-                    qWarning() << "Opening error window.";
-                    ErrorWindow *w = new ErrorWindow(this);
-                    w->addErrors(errorFiles);
-                    w->show();
-                }
-                ui->ValidateButton->setEnabled(true);
-                ui->listWidget->setEnabled(true);
-            }
-            return;
-        }
+void MainWindow::showProgress(const ProgressTracker::Snapshot &snapshot) {
 
-        if(item->urls.isEmpty()) {
-            qWarning() << "failed to download " << item->fname;
-            errorFiles.append(item->fname + " failed to download");
-            if(currentFiles + errorFiles.length() >= maxFiles) {
-                ui->ValidateButton->setEnabled(true);
-                ui->listWidget->setEnabled(true);
-                qWarning() << "Opening error window.";
-                ErrorWindow *w = new ErrorWindow(this);
-                w->addErrors(errorFiles);
-                w->show();
-            }
-            return;
-        }
+    // Another launch profile may be selected meanwhile.
+    if(validating != manifest)
+        return;
 
-        QFileInfo(item->fname).dir().mkpath(".");
-        QSaveFile *file = new QSaveFile(item->fname);
-        if(!file->open(QIODevice::WriteOnly)) {
-            qWarning() << "failed to write to " << item->fname;
-            errorFiles.append(item->fname + " failed to create");
-            if(currentFiles + errorFiles.length() >= maxFiles) {
-                ui->ValidateButton->setEnabled(true);
-                ui->listWidget->setEnabled(true);
-                qWarning() << "Opening error window.";
-                ErrorWindow *w = new ErrorWindow(this);
-                w->addErrors(errorFiles);
-                w->show();
-            }
-            return;
-        }
+    ui->UpdateProgress->setValue(snapshot.total > 0
+                                 ? int(snapshot.done * PROGRESS_STEPS / snapshot.total)
+                                 : PROGRESS_STEPS);
 
-        QNetworkRequest req(*item->urls.takeLast());
-        req.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
-        QNetworkReply *res = netMan.get(req);
-        connect (
-            res,
-            &QNetworkReply::readyRead,
-            [=] {
-               file->write(res->read(res->bytesAvailable()));
-            });
-        connect (
-            res,
-            &QNetworkReply::finished,
-            [=] {
+    if(snapshot.bytesPerSecond <= 0 || snapshot.done >= snapshot.total) {
+        ui->UpdateProgress->setFormat("%p%");
+        return;
+    }
 
-               if(res->error() != QNetworkReply::NoError)
-                   qWarning() << res->request().url() << res->errorString();
+    QString eta = snapshot.eta < 0 ? "?" : QString("%1:%2")
+            .arg(snapshot.eta / 60)
+            .arg(snapshot.eta % 60, 2, 10, QChar('0'));
+    ui->UpdateProgress->setFormat(QString("%p% - %1/s - %2 left")
+                                  .arg(QLocale().formattedDataSize(snapshot.bytesPerSecond))
+                                  .arg(eta));
 
-               res->deleteLater();
-               file->commit();
-               this->downloadItem(item);
+}
 
-            });
+/*
+ * Re-enable the UI once every file in the manifest has
+ * either been validated or failed, and show any errors.
+ */
+void MainWindow::finishValidation(const QStringList &errors) {
 
-        watcher->deleteLater();
+    Manifest *validated = validating;
+    validating = nullptr;
 
-    });
+    if(errors.isEmpty()) {
+        if(validated == manifest) {
+            ui->UpdateProgress->setValue(PROGRESS_STEPS);
+            ui->LaunchButton->setEnabled(true);
+        }
+    }
+    else {
+        qWarning() << "Opening error window.";
+        ErrorWindow *w = new ErrorWindow(this);
+        w->addErrors(errors);
+        w->show();
+    }
 
-    watcher->setFuture(future);
+    ui->ValidateButton->setEnabled(manifest != nullptr);
 
 }
 
@@ -222,151 +240,50 @@ void MainWindow::addServerEntry(ServerEntry *server) {
     QListWidgetItem *item = new QListWidgetItem(server->name, ui->listWidget);
     item->setData(Qt::UserRole + 1, QVariant::fromValue(server));
 
-    // Download the launch profile icon if it's there is one available.
+    /*
+     * Fetch the launch profile icon and the message of the
+     * day (MoTD) if there are any. The list may be cleared
+     * before they arrive, so the item is looked up again.
+     */
     if(!server->icon.isEmpty()) {
-        QNetworkRequest req(server->icon);
-        req.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
-        QNetworkReply *res = netMan.get(req);
-        connect (
-            res,
-            &QNetworkReply::finished,
-            [=] {
-
-               if(res->error() != QNetworkReply::NoError) {
-                   qWarning() << "icon: " << res->errorString();
-                   return;
-               }
-
-               QPixmap pixels;
-               if(!pixels.loadFromData(res->readAll()))
-                   qWarning() << "unable to read icon: " << server->icon;
-               else
-                   item->setIcon(QIcon(pixels));
-
-               res->deleteLater();
-
-            });
+        resources.fetchPixmap (
+                    server->icon,
+                    server,
+                    [=](const QPixmap &pixels) {
+                        if(QListWidgetItem *entry = findServerEntry(server))
+                            entry->setIcon(QIcon(pixels));
+                    },
+                    [=](const QString &error) {
+                        qWarning() << "icon: " << error;
+                    });
     }
 
-    // Download the message of the day (MoTD) if one is available.
     if(!server->motd.isEmpty()) {
-        QNetworkRequest req(server->motd);
-        req.setHeader(QNetworkRequest::UserAgentHeader, "Sweet Tea / 1.2.0");
-        req.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
-        QNetworkReply *res = netMan.get(req);
         item->setData(Qt::UserRole, "Retrieving MoTD");
-        connect (
-            res,
-            &QNetworkReply::finished,
-            [=] {
-
-               if(res->error() != QNetworkReply::NoError) {
-                   qWarning() << "motd: " << res->errorString();
-                   item->setData(Qt::UserRole, "Failed to retrieve MoTD");
-                   return;
-               }
-
-               QString motd(res->read(140));
-               item->setData(Qt::UserRole, motd);
-
-               res->deleteLater();
-
-            });
+        resources.fetch (
+                    server->motd,
+                    server,
+                    [=](const QByteArray &data) {
+                        if(QListWidgetItem *entry = findServerEntry(server))
+                            entry->setData(Qt::UserRole, QString(data.left(140)));
+                    },
+                    [=](const QString &error) {
+                        qWarning() << "motd: " << error;
+                        if(QListWidgetItem *entry = findServerEntry(server))
+                            entry->setData(Qt::UserRole, "Failed to retrieve MoTD");
+                    });
     }
 
 }
 
-/*
- * Read a manifest file from the local file system.
- */
-void MainWindow::openManifest(QString fname) {
-
-    /*
-     * Disable the validate button so it's not
-     * pressed while a manifest is being read
-     * still.
-     */
-    ui->ValidateButton->setEnabled(false);
-    ui->UpdateProgress->setValue(false);
-
-    // Parse the XML of the manifest.
-    QDomDocument doc;
-    QFile file(fname);
-
-    if(file.open(QIODevice::ReadOnly) && doc.setContent(&file)) {
-
-        // Hash the manifest to easily compare to other manifests.
-        QCryptographicHash md5(QCryptographicHash::Md5);
-        md5.addData(doc.toByteArray());
-
-        // Create a manifest object from the XML file.
-        // Add its server entries (launch profiles) to the list.
-        Manifest *manifest = new Manifest(doc, md5.result());
-        for(ServerEntry *server : manifest->servers)
-            addServerEntry(server);
+QListWidgetItem *MainWindow::findServerEntry(ServerEntry *server) {
 
+    for(int i = 0; i < ui->listWidget->count(); i++) {
+        QListWidgetItem *item = ui->listWidget->item(i);
+        if(item->data(Qt::UserRole + 1).value<ServerEntry*>() == server)
+            return item;
     }
-
-    else
-        // Log a critical error if the manifest can't be read.
-        // FIXME: Add to error list.
-        // FIXME: Make error critical.
-        qWarning() << "unable to read manifest: " + fname;
-
-    file.close();
-
-}
-
-/*
- * Download a manifest.
- */
-void MainWindow::downloadManifest(QUrl url) {
-
-    /*
-     * Disable the validate button so it's not
-     * pressed while a manifest is being downloaded
-     * still.
-     */
-    ui->ValidateButton->setEnabled(false);
-    ui->UpdateProgress->setValue(false);
-
-    /*
-     * Send an HTTP request to download the manifest,
-     * and add its launch profiles (server entries) to the
-     * list for display on success response.
-     */
-    QNetworkRequest req(url);
-    req.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
-    QNetworkReply *res = netMan.get(req);
-    connect (
-        res,
-        &QNetworkReply::finished,
-        [=] {
-
-           // Log a critical error if the manifest can't be downloaded.
-           // FIXME: Add to error list.
-           if(res->error() != QNetworkReply::NoError)
-               qCritical() << "manifest: " << res->errorString();
-
-           // Parse the XML of the manifest.
-           QByteArray content = res->readAll();
-           QDomDocument doc = QDomDocument();
-           doc.setContent(content);
-
-           // Hash the manifest to easily compare to other manifests.
-           QCryptographicHash md5(QCryptographicHash::Md5);
-           md5.addData(content);
-
-           // Create a manifest object from the XML file.
-           // Add its server entries (launch profiles) to the list.
-           Manifest *manifest = new Manifest(doc, md5.result());
-           for(ServerEntry *server : manifest->servers)
-               addServerEntry(server);
-
-           // Delete the response object to avoid memory leaks.
-           res->deleteLater();
-
-        });
+    return nullptr;
 
 }
 
@@ -384,37 +301,36 @@ void MainWindow::setManifest(Manifest *manifest) {
     /*
      * Since a manifest is needed for validation,
      * enable the validation button once a manifest
-     * is selected. Disable the launch button until
-     * that manifest has been validated, and set
-     * validation progress to 0.
+     * is selected, unless it's the one being validated.
+     * Disable the launch button until that manifest has
+     * been validated, and set validation progress to 0.
      */
     ui->LaunchButton->setEnabled(false);
-    ui->ValidateButton->setEnabled(true);
+    ui->ValidateButton->setEnabled(manifest != validating);
     ui->UpdateProgress->setValue(0);
 
     /*
-     * The checksum from the last valid manifest, and
-     * the last directory used to download files can
-     * be compared to the current manifest and directory
-     * to determine if validation is necessary.
+     * Check the files' metadata against the validation
+     * cache in the background. If nothing changed since
+     * the last validation, launching can be enabled without
+     * hashing anything.
      */
-    QSettings settings;
-    QByteArray oldChecksum = settings.value("manifestChecksum").toByteArray();
-    QString oldDir = settings.value("oldDir").toString();
-    qInfo() << "old manifest: " + oldChecksum.toHex();
-    qInfo() << "new manifest: " + manifest->checksum.toHex();
-    qInfo() << "old dir: " + oldDir;
-    qInfo() << "new dir: " + QDir::currentPath();
+    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, [=] {
 
-    /*
-     * Enable launching if this manifest is the last valid one.
-     */
-    if(oldChecksum == manifest->checksum && oldDir == QDir::currentPath()) {
-        currentFiles = manifest->items.size();
-        ui->UpdateProgress->setValue(currentFiles);
-        ui->UpdateProgress->setMaximum(currentFiles);
-        ui->LaunchButton->setEnabled(true);
-    }
+        // Ignore the result if another manifest was selected since.
+        if(watcher->result() && this->manifest == manifest && ui->ValidateButton->isEnabled()) {
+            qInfo() << "manifest unchanged since last validation";
+            ui->UpdateProgress->setValue(PROGRESS_STEPS);
+            ui->LaunchButton->setEnabled(true);
+        }
+
+        watcher->deleteLater();
+
+    });
+    watcher->setFuture(QtConcurrent::run([=] {
+        return updater.isCached(manifest);
+    }));
 
 }
 
@@ -425,42 +341,31 @@ void MainWindow::setManifest(Manifest *manifest) {
 void MainWindow::validateManifest(Manifest *manifest) {
 
     /*
-     * Clear the last valid manifest and download
-     * directory, so that validation is not skipped
-     * again until another manifest is validated.
+     * Files that haven't changed since they were last
+     * validated are skipped, unless the user asked for
+     * every file to be hashed again.
      */
     QSettings settings;
-    settings.remove("manifestChecksum");
-    settings.remove("oldDir");
+    bool forceRehash = settings.value("forceRehash", false).toBool();
 
     /*
      * Delete any files that are designated for
      * deletion in the manifest.
      */
-    for(QString *item : manifest->deletions)
+    for(const QString &item : manifest->deletions)
         deleteItem(item);
 
     /*
-     * FIXME: The current file count was used for
-     * other things, but not it's only here for the
-     * progress bar. This can be removed later.
-     */
-    currentFiles = 0;
-    errorFiles.clear();
-    maxFiles = manifest->items.size();
-
-    /*
-     * Disable the UI elements, so they aren't pressed
-     * during validation.
+     * Disable the buttons, so they aren't pressed during
+     * validation. Another launch profile can still be picked
+     * and validated, which takes over from this one.
      */
     ui->ValidateButton->setEnabled(false);
     ui->LaunchButton->setEnabled(false);
-    ui->listWidget->setEnabled(false);
-    ui->UpdateProgress->setMaximum(maxFiles);
 
-    // Download and/or validate each file in the manifest.
-    for(ManifestItem *item : manifest->items)
-        downloadItem(item);
+    // Validate each file in the manifest, and download the ones that fail.
+    validating = manifest;
+    updater.update(manifest, forceRehash);
 
 }
 
@@ -474,18 +379,16 @@ void MainWindow::loadManifests() {
     QSettings settings;
     QStringList manifests = settings.value("manifests").toString().split(" ");
 
-    for(QString manifest : manifests) {
-        QUrl url = QUrl::fromUserInput(manifest);
-
-        // Download the manifest if it's not a local file.
-        if(!url.isLocalFile())
-            downloadManifest(url);
-
-        // Read the manifest from the local file system.
-        else
-            openManifest(manifest);
+    /*
+     * Disable the validate button so it's not
+     * pressed while manifests are being loaded
+     * still.
+     */
+    ui->ValidateButton->setEnabled(false);
+    ui->UpdateProgress->setValue(0);
 
-    }
+    for(QString manifest : manifests)
+        loader.load(manifest);
 
 }
 
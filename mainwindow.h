@@ -2,11 +2,15 @@
 #define MAINWINDOW_H
 
 #include "manifest.h"
-#include "manifestitem.h"
+#include "manifestloader.h"
+#include "updater.h"
+#include "gamewatcher.h"
+#include "resourcecache.h"
 
 #include <QMainWindow>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
+#include <QListWidgetItem>
 #include <QProgressDialog>
 
 QT_BEGIN_NAMESPACE
@@ -24,18 +28,20 @@ private:
     QNetworkAccessManager netMan;
     Ui::MainWindow *ui;
     Manifest* manifest;
-    long currentFiles;
-    QList<QString> errorFiles;
-    long maxFiles;
+    Manifest* validating;
+    ManifestLoader loader;
+    Updater updater;
+    GameWatcher games;
+    ResourceCache resources;
 
     void setup();
     void addServerEntry(ServerEntry* server);
+    QListWidgetItem *findServerEntry(ServerEntry *server);
     void setManifest(Manifest* manifest);
     void validateManifest(Manifest* manifest);
-    void downloadManifest(QUrl url);
-    void openManifest(QString fname);
-    void downloadItem(ManifestItem* item);
-    void deleteItem(QString *item);
+    void showProgress(const ProgressTracker::Snapshot &snapshot);
+    void finishValidation(const QStringList &errors);
+    void deleteItem(const QString &item);
     void loadManifests();
 
 };
@@ -1,84 +1,312 @@
 #include "manifest.h"
+#include "filewatcher.h"
 
-#include <QNetworkRequest>
-#include <QNetworkReply>
+#include <QDir>
+#include <QHash>
+#include <QUrl>
 #include <QtDebug>
 
-Manifest::Manifest(QDomDocument &doc, QByteArray checksum, QObject *parent)
+#include <cstring>
+
+// Items are allocated in blocks that double up to this many.
+static const int MAX_BLOCK = 4096;
+
+/*
+ * An empty manifest, to be filled in by the caller.
+ */
+Manifest::Manifest(QByteArray checksum, QObject *parent)
+    : QObject(parent),
+      checksum(checksum),
+      blockUsed(0),
+      blockSize(0) {}
+
+/*
+ * Parse a manifest in a single pass over the XML, without
+ * building a document tree first.
+ */
+Manifest::Manifest(QIODevice *device, QByteArray checksum, QObject *parent)
     : QObject(parent),
-      checksum(checksum) {
-
-    QDomNodeList filelists = doc.elementsByTagName("file");
-    for(int i = 0; i < filelists.size(); i++) {
-        QDomNode node = filelists.item(i);
-        QString name = node
-                .attributes()
-                .namedItem("name")
-                .nodeValue()
-                .trimmed();
-        long size = node
-                .attributes()
-                .namedItem("size")
-                .nodeValue()
-                .trimmed()
-                .toLong();
-        QByteArray md5 = QByteArray::fromHex(node
-                                             .attributes()
-                                             .namedItem("md5")
-                                             .nodeValue()
-                                             .trimmed()
-                                             .toLatin1());
-        QList<QUrl*> urls;
-        QDomNodeList children = node.childNodes();
-        for(int j = 0; j < children.size(); j++) {
-            QDomNode child = children.item(j);
-            urls.append(new QUrl(child.toElement().text().trimmed()));
+      checksum(checksum),
+      blockUsed(0),
+      blockSize(0) {
+
+    QXmlStreamReader xml(device);
+    ContentHash::Algorithm defaultAlgorithm = ContentHash::Md5;
+    bool root = true;
+
+    while(!xml.atEnd()) {
+
+        if(xml.readNext() != QXmlStreamReader::StartElement)
+            continue;
+
+        // The root element sets the default hash algorithm.
+        if(root) {
+            root = false;
+            QString defaultHash = xml.attributes().value("hash").toString();
+            if(!ContentHash::fromName(defaultHash, defaultAlgorithm))
+                qWarning() << "unknown hash for manifest: " << defaultHash;
+            continue;
         }
-        if(!QDir(name).isAbsolute() && !name.contains(".."))
-            if(size == 0)
-                deletions.append(new QString(name));
-            else
-                items.append(new ManifestItem(name, md5, size, urls, this));
-        else
-            qWarning() << "insecure path not allowed for file: " << name;
+
+        if(xml.name() == "file")
+            readFile(xml, defaultAlgorithm);
+        else if(xml.name() == "pack")
+            readPack(xml);
+        else if(xml.name() == "deletefile")
+            readDeletion(xml);
+        else if(xml.name() == "launch")
+            readLaunch(xml);
+
+    }
+
+    /*
+     * Whatever was read before the error is only part of the
+     * manifest, so the manifest is marked as broken rather
+     * than used as if it were complete.
+     */
+    if(xml.hasError()) {
+        error = xml.errorString() + " at line " + QString::number(xml.lineNumber());
+        qWarning() << "manifest: " << error;
+    }
+
+    qInfo() << "manifest: " << items.size() << " files in "
+            << directories.size() << " directories from "
+            << mirrors.size() << " mirror paths and "
+            << packs.size() << " packs";
+
+}
+
+Manifest::~Manifest() {
+    for(ManifestItem *block : blocks)
+        delete[] block;
+}
+
+/*
+ * Add a file to the manifest. Directories and the mirror
+ * URLs up to their last slash are stored once no matter
+ * how many files share them.
+ */
+ManifestItem *Manifest::addItem (
+        const QString &fname,
+        const QByteArray &digest,
+        ContentHash::Algorithm algorithm,
+        StreamDecoder::Encoding encoding,
+        qint64 size,
+        const QStringList &urls ) {
+
+    if(blockUsed == blockSize) {
+        blockSize = qMin(qMax(blockSize * 2, 64), MAX_BLOCK);
+        blocks.append(new ManifestItem[blockSize]);
+        blockUsed = 0;
+    }
+    ManifestItem *item = &blocks.last()[blockUsed++];
+
+    int slash = fname.lastIndexOf('/') + 1;
+    item->manifest = this;
+    item->directory = intern(fname.left(slash), directories, directoryIndex);
+    item->name = fname.mid(slash);
+    item->size = size;
+    item->algorithm = algorithm;
+    item->encoding = encoding;
+    item->digestLength = quint8(qMin(digest.size(), int(ManifestItem::MAX_DIGEST)));
+    memcpy(item->digestData, digest.constData(), item->digestLength);
+
+    item->firstLocation = quint32(locations.size());
+    item->locationCount = quint16(qMin(urls.size(), 0xffff));
+    for(int i = 0; i < item->locationCount; i++) {
+        slash = urls[i].lastIndexOf('/') + 1;
+        Location location;
+        location.mirror = intern(urls[i].left(slash), mirrors, mirrorIndex);
+        location.path = urls[i].mid(slash);
+
+        // Most mirrors name the file the same way, so share the string.
+        if(location.path == item->name)
+            location.path = item->name;
+        locations.append(location);
+    }
+
+    items.append(item);
+    return item;
+
+}
+
+/*
+ * Put a file in a pack, at the offset where its bytes
+ * start. The pack's URLs may be added before or after.
+ */
+void Manifest::setPack(ManifestItem *item, const QString &pack, qint64 offset) {
+
+    quint32 id = intern(pack, packs, packIndex);
+    packUrls.resize(packs.size());
+    item->pack = id + 1;
+    item->offset = offset;
+
+}
+
+void Manifest::addPack(const QString &name, const QStringList &urls) {
+
+    quint32 id = intern(name, packs, packIndex);
+    packUrls.resize(packs.size());
+    packUrls[int(id)] = urls;
+
+}
+
+QStringList Manifest::packNames() const {
+    return packs;
+}
+
+QStringList Manifest::packUrlsOf(const QString &name) const {
+    auto it = packIndex.constFind(name);
+    return it != packIndex.constEnd() ? packUrls.at(int(it.value())) : QStringList();
+}
+
+quint32 Manifest::intern(const QString &string, QStringList &strings, QHash<QString, quint32> &index) {
+
+    auto it = index.constFind(string);
+    if(it != index.constEnd())
+        return it.value();
+
+    quint32 id = quint32(strings.size());
+    strings.append(string);
+    index.insert(string, id);
+    return id;
+
+}
+
+void Manifest::readFile(QXmlStreamReader &xml, ContentHash::Algorithm defaultAlgorithm) {
+
+    QXmlStreamAttributes attributes = xml.attributes();
+    QString name = attributes.value("name").toString().trimmed();
+    long size = attributes.value("size").toString().trimmed().toLong();
+
+    /*
+     * The digest is read from the attribute named after the
+     * file's hash algorithm, which defaults to the document's.
+     * MD5 is used instead when the algorithm isn't supported.
+     */
+    ContentHash::Algorithm algorithm = defaultAlgorithm;
+    QString hashName = attributes.value("hash").toString();
+    if(!hashName.trimmed().isEmpty() && !ContentHash::fromName(hashName, algorithm))
+        qWarning() << "unknown hash " << hashName << " for file: " << name;
+    ContentHash::Algorithm wanted = algorithm;
+    if(!ContentHash::isSupported(algorithm))
+        algorithm = ContentHash::Md5;
+    QByteArray digest = QByteArray::fromHex(attributes
+                                            .value(ContentHash::name(algorithm))
+                                            .toString()
+                                            .trimmed()
+                                            .toLatin1());
+
+    /*
+     * Without an MD5 digest to fall back on, the file keeps
+     * the algorithm this build lacks, so updating it fails
+     * with an error saying so, rather than every copy of it
+     * looking corrupt.
+     */
+    if(digest.isEmpty() && algorithm != wanted) {
+        qWarning() << ContentHash::name(wanted) << " isn't supported by this build, and there's no md5 digest for file: " << name;
+        algorithm = wanted;
+        digest = QByteArray::fromHex(attributes
+                                     .value(ContentHash::name(algorithm))
+                                     .toString()
+                                     .trimmed()
+                                     .toLatin1());
     }
 
-    QDomNodeList deleteList = doc.elementsByTagName("deletefile");
-    for(int i = 0; i < deleteList.size(); i++) {
-        QDomNode node = deleteList.item(i);
-        QString name = node.toElement().text().trimmed();
-        if(!QDir(name).isAbsolute() && !name.contains(".."))
-            deletions.append(new QString(name));
-        else
-            qWarning() << "insecure path not allowed for file: " << name;
+    /*
+     * The URLs may serve the file compressed. The size
+     * and digest still describe the file once it's
+     * decompressed. URLs in an encoding this build can't
+     * decode are dropped, so the file can still be
+     * validated, but fails plainly if it has to be
+     * downloaded, rather than failing its digest.
+     */
+    StreamDecoder::Encoding encoding = StreamDecoder::Identity;
+    QString encodingName = attributes.value("encoding").toString();
+    bool decodable = StreamDecoder::fromName(encodingName, encoding) && StreamDecoder::isSupported(encoding);
+    if(!decodable) {
+        qWarning() << "unsupported encoding " << encodingName << " for file: " << name;
+        encoding = StreamDecoder::Identity;
+    }
+
+    /*
+     * Small files can also be stored in a pack, uncompressed,
+     * starting at the given offset. The pack is named rather
+     * than linked, and its URLs are listed on its own.
+     */
+    QString pack = attributes.value("pack").toString().trimmed();
+    bool validOffset = false;
+    qint64 offset = attributes.value("offset").toString().trimmed().toLongLong(&validOffset);
+    if(!pack.isEmpty() && (!validOffset || offset < 0)) {
+        qWarning() << "invalid pack offset for file: " << name;
+        pack.clear();
+    }
+
+    // Every child element of a file is one of its URLs.
+    QStringList urls;
+    while(xml.readNextStartElement())
+        urls.append(xml.readElementText(QXmlStreamReader::IncludeChildElements).trimmed());
+    if(!decodable)
+        urls.clear();
+
+    if(QDir(name).isAbsolute() || name.contains("..")) {
+        qWarning() << "insecure path not allowed for file: " << name;
+        return;
     }
 
-    QDomNodeList profiles = doc.elementsByTagName("launch");
-    for(int i = 0; i < profiles.size(); i++) {
-        QDomNode node = profiles.item(i);
-        QString name = node.toElement().text().trimmed();
-        QUrl icon(node.attributes()
-                  .namedItem("icon")
-                  .nodeValue()
-                  .trimmed());
-        QString client = node.attributes()
-                .namedItem("exec")
-                .nodeValue()
-                .trimmed();
-        QUrl motd(node.attributes()
-                  .namedItem("motd")
-                  .nodeValue()
-                  .trimmed());
-        QString args = node.attributes()
-                .namedItem("params")
-                .nodeValue()
-                .trimmed();
-        if(!QDir(client).isAbsolute() && !client.contains(".."))
-            servers.append(new ServerEntry(name, motd, icon, client, args, this, this));
-        else
-            qWarning() << "insecure path not allowed for client: " << client;
+    if(size == 0) {
+        deletions.append(name);
+        return;
     }
 
+    ManifestItem *item = addItem(name, digest, algorithm, encoding, size, urls);
+    if(!pack.isEmpty())
+        setPack(item, pack, offset);
+
+}
+
+/*
+ * A pack of small files, and the URLs it can be fetched
+ * from. Its index is the offsets given by its files.
+ */
+void Manifest::readPack(QXmlStreamReader &xml) {
+
+    QString name = xml.attributes().value("name").toString().trimmed();
+    QStringList urls;
+    while(xml.readNextStartElement())
+        urls.append(xml.readElementText(QXmlStreamReader::IncludeChildElements).trimmed());
+
+    if(name.isEmpty())
+        qWarning() << "pack without a name";
+    else
+        addPack(name, urls);
+
+}
+
+void Manifest::readDeletion(QXmlStreamReader &xml) {
+
+    QString name = xml.readElementText(QXmlStreamReader::IncludeChildElements).trimmed();
+    if(!QDir(name).isAbsolute() && !name.contains(".."))
+        deletions.append(name);
+    else
+        qWarning() << "insecure path not allowed for file: " << name;
+
+}
+
+void Manifest::readLaunch(QXmlStreamReader &xml) {
+
+    QXmlStreamAttributes attributes = xml.attributes();
+    QUrl icon(attributes.value("icon").toString().trimmed());
+    QString client = attributes.value("exec").toString().trimmed();
+    QUrl motd(attributes.value("motd").toString().trimmed());
+    QString args = attributes.value("params").toString().trimmed();
+    QString name = xml.readElementText(QXmlStreamReader::IncludeChildElements).trimmed();
+
+    if(!QDir(client).isAbsolute() && !client.contains(".."))
+        servers.append(new ServerEntry(name, motd, icon, client, args, this, this));
+    else
+        qWarning() << "insecure path not allowed for client: " << client;
+
 }
 
 bool Manifest::validate() {
@@ -86,3 +314,73 @@ bool Manifest::validate() {
         item->validate();
     return true;
 }
+
+/*
+ * Check, without hashing anything, whether every file in
+ * the manifest is unchanged since it was last validated.
+ */
+bool Manifest::isCached(ValidationCache *cache) {
+    ValidationCache::Entry stamp;
+    for(ManifestItem *item : items) {
+        QString fname = item->fname();
+        if(!ValidationCache::stat(fname, stamp) || stamp.size != item->size)
+            return false;
+        stamp.digest = item->digest();
+        if(!cache->matches(fname, stamp))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * List the files that have to be validated again after
+ * the previous manifest was: the ones that were added or
+ * changed since, and the ones that changed on disk. If the
+ * paths touched on disk since are known, only those are
+ * looked at, and they're hashed whatever their metadata.
+ * The rest must still have been last validated with the
+ * same digest, in case another manifest put other contents
+ * there in between.
+ */
+QList<ManifestItem*> Manifest::changedSince(Manifest *previous, ValidationCache *cache, const QSet<QString> *touched) {
+
+    QHash<QString, ManifestItem*> before;
+    for(ManifestItem *item : previous->items)
+        before.insert(item->fname(), item);
+
+    QList<ManifestItem*> changed;
+    ValidationCache::Entry stamp;
+    for(ManifestItem *item : items) {
+
+        QString fname = item->fname();
+        ManifestItem *old = before.value(fname);
+        if(!old
+                || old->size != item->size
+                || old->digest() != item->digest()
+                || old->algorithm != item->algorithm) {
+            changed.append(item);
+            continue;
+        }
+
+        if(touched) {
+            if(FileWatcher::touched(*touched, fname)) {
+                cache->remove(fname);
+                changed.append(item);
+            } else if(!cache->matches(fname, item->digest())) {
+                changed.append(item);
+            }
+            continue;
+        }
+
+        // Same entry, but the file itself may have been touched.
+        stamp.digest = item->digest();
+        if(!ValidationCache::stat(fname, stamp)
+                || stamp.size != item->size
+                || !cache->matches(fname, stamp))
+            changed.append(item);
+
+    }
+
+    return changed;
+
+}
@@ -3,22 +3,74 @@
 
 #include "manifestitem.h"
 #include "serverentry.h"
+#include "validationcache.h"
 
 #include <QObject>
-#include <QtXml>
+#include <QIODevice>
+#include <QXmlStreamReader>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QSet>
 
 class Manifest : public QObject
 {
     Q_OBJECT
 public:
-    explicit Manifest(QDomDocument &doc, QByteArray checksum, QObject *parent = nullptr);
+    explicit Manifest(QByteArray checksum, QObject *parent = nullptr);
+    explicit Manifest(QIODevice *device, QByteArray checksum, QObject *parent = nullptr);
+    ~Manifest();
+    ManifestItem *addItem (
+            const QString &fname,
+            const QByteArray &digest,
+            ContentHash::Algorithm algorithm,
+            StreamDecoder::Encoding encoding,
+            qint64 size,
+            const QStringList &urls );
+    void setPack(ManifestItem *item, const QString &pack, qint64 offset);
+    void addPack(const QString &name, const QStringList &urls);
+    QStringList packNames() const;
+    QStringList packUrlsOf(const QString &name) const;
     bool validate();
+    bool isCached(ValidationCache *cache);
+    QList<ManifestItem*> changedSince(Manifest *previous, ValidationCache *cache, const QSet<QString> *touched = nullptr);
 
     QByteArray checksum;
+    QString error;
     QList<ManifestItem*> items;
-    QList<QString*> deletions;
+    QStringList deletions;
     QList<ServerEntry*> servers;
 
+private:
+    friend class ManifestItem;
+
+    /*
+     * A mirror URL of one file, split into the part
+     * shared with other files and the part that isn't.
+     */
+    struct Location {
+        quint32 mirror;
+        QString path;
+    };
+
+    QStringList directories;
+    QHash<QString, quint32> directoryIndex;
+    QStringList mirrors;
+    QHash<QString, quint32> mirrorIndex;
+    QVector<Location> locations;
+    QStringList packs;
+    QHash<QString, quint32> packIndex;
+    QVector<QStringList> packUrls;
+    QVector<ManifestItem*> blocks;
+    int blockUsed;
+    int blockSize;
+
+    static quint32 intern(const QString &string, QStringList &strings, QHash<QString, quint32> &index);
+    void readFile(QXmlStreamReader &xml, ContentHash::Algorithm defaultAlgorithm);
+    void readPack(QXmlStreamReader &xml);
+    void readDeletion(QXmlStreamReader &xml);
+    void readLaunch(QXmlStreamReader &xml);
+
 };
 
 #endif // MANIFEST_H
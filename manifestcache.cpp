@@ -0,0 +1,248 @@
+#include "manifestcache.h"
+
+#include <QStandardPaths>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QSettings>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+static const quint32 CACHE_MAGIC = 0x53544d43; // "STMC"
+static const quint32 CACHE_VERSION = 3;
+
+// How many cached manifests are kept around.
+static const int CACHE_ENTRIES = 16;
+
+QString ManifestCache::path(const QByteArray &checksum) {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + "/manifests/" + QString::fromLatin1(checksum.toHex()) + ".bin";
+}
+
+/*
+ * Load a manifest with the given checksum, or return
+ * null if it isn't cached or the cache can't be read.
+ */
+Manifest *ManifestCache::load(const QByteArray &checksum) {
+
+    Manifest *manifest = read(path(checksum));
+    if(manifest && manifest->checksum != checksum) {
+        delete manifest;
+        return nullptr;
+    }
+    return manifest;
+
+}
+
+bool ManifestCache::save(Manifest *manifest) {
+
+    QString fname = path(manifest->checksum);
+    if(!write(manifest, fname))
+        return false;
+
+    prune(fname);
+    return true;
+
+}
+
+/*
+ * The last manifest that every file was validated against,
+ * kept apart from the others so it's never pruned.
+ */
+Manifest *ManifestCache::loadValidated() {
+    return read(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/validated.manifest");
+}
+
+bool ManifestCache::saveValidated(Manifest *manifest) {
+    return write(manifest, QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/validated.manifest");
+}
+
+Manifest *ManifestCache::read(const QString &fname) {
+
+    QFile file(fname);
+    if(!file.open(QIODevice::ReadOnly))
+        return nullptr;
+
+    /*
+     * Decode straight from the mapped file, so it's paged
+     * in as it's read rather than copied up front.
+     */
+    qint64 length = file.size();
+    uchar *data = file.map(0, length);
+    if(!data)
+        return nullptr;
+    QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(data), int(length));
+    QDataStream in(bytes);
+
+    quint32 magic, version;
+    QByteArray checksum;
+    in >> magic >> version >> checksum;
+    if(magic != CACHE_MAGIC || version != CACHE_VERSION) {
+        qWarning() << "ignoring incompatible manifest cache: " << file.fileName();
+        return nullptr;
+    }
+
+    Manifest *manifest = new Manifest(checksum);
+
+    quint32 count;
+    in >> count;
+    for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        QString fname;
+        QByteArray digest;
+        quint8 algorithm, encoding;
+        qint64 size;
+        quint32 urlCount;
+        in >> fname >> digest >> algorithm >> encoding >> size >> urlCount;
+        QStringList urls;
+        for(quint32 j = 0; j < urlCount && in.status() == QDataStream::Ok; j++) {
+            QString url;
+            in >> url;
+            urls.append(url);
+        }
+        QString pack;
+        qint64 offset;
+        in >> pack >> offset;
+        ManifestItem *item = manifest->addItem (
+                    fname,
+                    digest,
+                    ContentHash::Algorithm(algorithm),
+                    StreamDecoder::Encoding(encoding),
+                    size,
+                    urls );
+        if(!pack.isEmpty())
+            manifest->setPack(item, pack, offset);
+    }
+
+    in >> count;
+    for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        QString fname;
+        in >> fname;
+        manifest->deletions.append(fname);
+    }
+
+    in >> count;
+    for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        QString name, motd, icon, client, args;
+        in >> name >> motd >> icon >> client >> args;
+        manifest->servers.append(new ServerEntry(name, QUrl(motd), QUrl(icon), client, args, manifest, manifest));
+    }
+
+    in >> count;
+    for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        QString name;
+        QStringList urls;
+        in >> name >> urls;
+        manifest->addPack(name, urls);
+    }
+
+    if(in.status() != QDataStream::Ok) {
+        qWarning() << "corrupt manifest cache: " << file.fileName();
+        delete manifest;
+        return nullptr;
+    }
+
+    return manifest;
+
+}
+
+bool ManifestCache::write(Manifest *manifest, const QString &fname) {
+
+    QFileInfo(fname).dir().mkpath(".");
+    QSaveFile file(fname);
+    if(!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "unable to write manifest cache: " << fname;
+        return false;
+    }
+
+    QDataStream out(&file);
+    out << CACHE_MAGIC << CACHE_VERSION << manifest->checksum;
+
+    out << quint32(manifest->items.size());
+    for(ManifestItem *item : manifest->items) {
+        out << item->fname()
+            << item->digest()
+            << quint8(item->algorithm)
+            << quint8(item->encoding)
+            << qint64(item->size)
+            << quint32(item->urlCount());
+        for(const QUrl &url : item->urls())
+            out << url.toString();
+        out << item->packName() << qint64(item->packOffset());
+    }
+
+    out << quint32(manifest->deletions.size());
+    for(const QString &fname : manifest->deletions)
+        out << fname;
+
+    out << quint32(manifest->servers.size());
+    for(ServerEntry *server : manifest->servers)
+        out << server->name
+            << server->motd.toString()
+            << server->icon.toString()
+            << server->client
+            << server->args;
+
+    QStringList packs = manifest->packNames();
+    out << quint32(packs.size());
+    for(const QString &name : packs)
+        out << name << manifest->packUrlsOf(name);
+
+    return file.commit();
+
+}
+
+/*
+ * Where the last good copy of a downloaded manifest
+ * is kept. Its validators are stored next to it, in
+ * a ".meta" file.
+ */
+QString ManifestCache::downloadPath(const QUrl &url) {
+    QByteArray name = QCryptographicHash::hash(url.toEncoded(), QCryptographicHash::Md5).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + "/manifests/" + QString::fromLatin1(name) + ".xml";
+}
+
+/*
+ * Keep a downloaded manifest, along with the validators
+ * needed to ask the server whether it changed since.
+ */
+bool ManifestCache::saveDownload (
+        const QUrl &url,
+        const QByteArray &body,
+        const QByteArray &etag,
+        const QByteArray &lastModified ) {
+
+    QString fname = downloadPath(url);
+    QFileInfo(fname).dir().mkpath(".");
+    QSaveFile file(fname);
+    if(!file.open(QIODevice::WriteOnly) || file.write(body) != body.size() || !file.commit()) {
+        qWarning() << "unable to write manifest copy: " << fname;
+        return false;
+    }
+
+    /*
+     * The validators are written after the body, so they
+     * never describe a newer copy than the one on disk.
+     */
+    QSettings meta(fname + ".meta", QSettings::IniFormat);
+    meta.setValue("url", url.toString());
+    meta.setValue("etag", QString::fromLatin1(etag));
+    meta.setValue("lastModified", QString::fromLatin1(lastModified));
+    return true;
+
+}
+
+/*
+ * Remove all but the most recently written manifests.
+ */
+void ManifestCache::prune(const QString &keep) {
+
+    QDir dir(QFileInfo(keep).path());
+    QFileInfoList entries = dir.entryInfoList({"*.bin"}, QDir::Files, QDir::Time);
+    for(int i = CACHE_ENTRIES; i < entries.size(); i++)
+        if(entries[i].absoluteFilePath() != QFileInfo(keep).absoluteFilePath())
+            QFile::remove(entries[i].absoluteFilePath());
+
+}
@@ -0,0 +1,38 @@
+#ifndef MANIFESTCACHE_H
+#define MANIFESTCACHE_H
+
+#include "manifest.h"
+
+#include <QString>
+#include <QUrl>
+
+/*
+ * Keeps parsed manifests in a compact binary form, keyed
+ * by the checksum of their XML, so a manifest that hasn't
+ * changed is loaded from a memory mapped file instead of
+ * being parsed again.
+ */
+class ManifestCache
+{
+public:
+    static QString path(const QByteArray &checksum);
+    static Manifest *load(const QByteArray &checksum);
+    static bool save(Manifest *manifest);
+    static Manifest *loadValidated();
+    static bool saveValidated(Manifest *manifest);
+
+    static QString downloadPath(const QUrl &url);
+    static bool saveDownload (
+            const QUrl &url,
+            const QByteArray &body,
+            const QByteArray &etag,
+            const QByteArray &lastModified );
+
+private:
+    static Manifest *read(const QString &fname);
+    static bool write(Manifest *manifest, const QString &fname);
+    static void prune(const QString &keep);
+
+};
+
+#endif // MANIFESTCACHE_H
@@ -1,34 +1,125 @@
 #include "manifestitem.h"
+#include "manifest.h"
+#include "validationcache.h"
+#include "filereader.h"
+#include "metrics.h"
+#include "progresstracker.h"
 
-#include <QCryptographicHash>
-#include <QStandardPaths>
-#include <QDir>
-#include <QFile>
 #include <QDebug>
-#include <QSaveFile>
-
-ManifestItem::ManifestItem (
-            QString &fname,
-            QByteArray &md5,
-            long size,
-            QList<QUrl*> &urls,
-            QObject *parent )
-    : QObject(parent),
-    fname(fname),
-    md5(md5),
-    size(size),
-    urls(urls) {}
-
-bool ManifestItem::validate() {
-
-    QFile file (fname);
-    QFileInfo info(file.fileName());
-    QCryptographicHash hash(QCryptographicHash::Md5);
-
-    return info.exists()
-            && info.size() == size
-            && file.open(QFile::ReadOnly)
-            && hash.addData(&file)
-            && hash.result() == md5;
 
+ManifestItem::ManifestItem()
+    : size(0),
+      algorithm(ContentHash::Md5),
+      encoding(StreamDecoder::Identity),
+      manifest(nullptr),
+      directory(0),
+      pack(0),
+      offset(0),
+      firstLocation(0),
+      locationCount(0),
+      digestLength(0) {}
+
+QString ManifestItem::fname() const {
+    return manifest->directories.at(int(directory)) + name;
+}
+
+QByteArray ManifestItem::digest() const {
+    return QByteArray(digestData, digestLength);
+}
+
+QList<QUrl> ManifestItem::urls() const {
+    QList<QUrl> urls;
+    for(quint32 i = firstLocation; i < firstLocation + locationCount; i++) {
+        const Manifest::Location &location = manifest->locations.at(int(i));
+        urls.append(QUrl(manifest->mirrors.at(int(location.mirror)) + location.path));
+    }
+    return urls;
+}
+
+int ManifestItem::urlCount() const {
+    return locationCount;
+}
+
+/*
+ * Only files in a pack the manifest gives URLs for can be
+ * downloaded from it. Packs are numbered from one, so zero
+ * means the file isn't in one.
+ */
+bool ManifestItem::isPacked() const {
+    return pack > 0 && !manifest->packUrls.at(int(pack - 1)).isEmpty();
+}
+
+QList<QUrl> ManifestItem::packUrls() const {
+    QList<QUrl> urls;
+    if(pack > 0)
+        for(const QString &url : manifest->packUrls.at(int(pack - 1)))
+            urls.append(QUrl(url));
+    return urls;
+}
+
+QString ManifestItem::packName() const {
+    return pack > 0 ? manifest->packs.at(int(pack - 1)) : QString();
+}
+
+qint64 ManifestItem::packOffset() const {
+    return offset;
+}
+
+/*
+ * Check the file against its size and digest. When a cache
+ * is given, files whose metadata hasn't changed since they
+ * were last validated are not hashed again, unless forced.
+ * Files that aren't hashed count as progress all at once.
+ */
+bool ManifestItem::validate(ValidationCache *cache, bool force, ProgressTracker *progress) const {
+
+    QString fname = this->fname();
+    ValidationCache::Entry stamp;
+    if(!ValidationCache::stat(fname, stamp) || stamp.size != size) {
+        if(cache)
+            cache->remove(fname);
+        if(progress)
+            progress->addHashed(size);
+        return false;
+    }
+
+    stamp.digest = digest();
+    if(cache && !force && cache->matches(fname, stamp)) {
+        if(progress)
+            progress->addHashed(size);
+        return true;
+    }
+
+    qint64 started = Metrics::now();
+    ContentHash hash(algorithm);
+    hash.setProgress(progress);
+    bool valid = FileReader::read(fname, hash)
+            && hash.result() == stamp.digest;
+    Metrics::record("hash", fname, started, {
+        {"bytes", size},
+        {"algorithm", ContentHash::name(algorithm)},
+        {"valid", valid}});
+
+    if(cache) {
+        if(valid)
+            cache->insert(fname, stamp);
+        else
+            cache->remove(fname);
+    }
+
+    return valid;
+
+}
+
+/*
+ * Record the file as valid without hashing it, such as
+ * when it was already hashed while being downloaded.
+ */
+void ManifestItem::markValid(ValidationCache *cache) const {
+    QString fname = this->fname();
+    ValidationCache::Entry stamp;
+    if(!ValidationCache::stat(fname, stamp))
+        return;
+    stamp.digest = digest();
+    cache->insert(fname, stamp);
 }
@@ -1,25 +1,62 @@
 #ifndef MANIFESTITEM_H
 #define MANIFESTITEM_H
 
-#include <QObject>
+#include "contenthash.h"
+#include "streamdecoder.h"
 
-class ManifestItem : public QObject
+#include <QMetaType>
+#include <QUrl>
+
+class Manifest;
+class ValidationCache;
+class ProgressTracker;
+
+/*
+ * One file in a manifest. Manifests can list hundreds of
+ * thousands of files, so items are plain values kept in
+ * blocks by their manifest. The directory and the mirror
+ * URLs are indexes into strings the manifest shares among
+ * all of its files, and the digest is stored inline. A file
+ * may also be stored in a pack, at an offset, along with
+ * other small files.
+ */
+class ManifestItem
 {
-    Q_OBJECT
 public:
-    explicit ManifestItem (
-            QString &fname,
-            QByteArray &md5,
-            long size,
-            QList<QUrl*> &urls,
-            QObject *parent = nullptr );
-    bool validate();
-
-    QString fname;
-    QByteArray md5;
-    long size;
-    QList<QUrl*> urls;
+    // Large enough for the longest digest, BLAKE3's.
+    static const int MAX_DIGEST = 32;
+
+    ManifestItem();
+    QString fname() const;
+    QByteArray digest() const;
+    QList<QUrl> urls() const;
+    int urlCount() const;
+    bool isPacked() const;
+    QList<QUrl> packUrls() const;
+    QString packName() const;
+    qint64 packOffset() const;
+    bool validate(ValidationCache *cache = nullptr, bool force = false, ProgressTracker *progress = nullptr) const;
+    void markValid(ValidationCache *cache) const;
+
+    qint64 size;
+    ContentHash::Algorithm algorithm;
+    StreamDecoder::Encoding encoding;
+
+private:
+    friend class Manifest;
+
+    const Manifest *manifest;
+    QString name;
+    quint32 directory;
+    quint32 pack;
+    qint64 offset;
+    quint32 firstLocation;
+    quint16 locationCount;
+    quint8 digestLength;
+    char digestData[MAX_DIGEST];
 
 };
 
+Q_DECLARE_METATYPE(ManifestItem*)
+
 #endif // MANIFESTITEM_H
@@ -0,0 +1,218 @@
+#include "manifestloader.h"
+#include "manifestcache.h"
+#include "metrics.h"
+
+#include <QtConcurrent>
+#include <QNetworkReply>
+#include <QCryptographicHash>
+#include <QBuffer>
+#include <QFileInfo>
+#include <QSettings>
+#include <QTimer>
+#include <QDebug>
+
+ManifestLoader::ManifestLoader(QNetworkAccessManager *netMan, QObject *parent)
+    : QObject(parent),
+      netMan(netMan) {}
+
+/*
+ * Either download a manifest or read it from
+ * the local file system.
+ */
+void ManifestLoader::load(const QString &location) {
+
+    QUrl url = QUrl::fromUserInput(location);
+
+    // Download the manifest if it's not a local file.
+    if(!url.isLocalFile())
+        download(url);
+
+    // Read the manifest from the local file system.
+    else
+        open(location, location);
+
+}
+
+/*
+ * Read a manifest file from the local file system.
+ */
+void ManifestLoader::open(const QString &location, const QString &fname) {
+
+    // Read and parse the manifest in the background.
+    QFutureWatcher<QByteArray> *watcher = new QFutureWatcher<QByteArray>(this);
+    connect(watcher, &QFutureWatcher<QByteArray>::finished, [=] {
+
+        watcher->deleteLater();
+
+        if(watcher->result().isNull()) {
+            qWarning() << "unable to read manifest: " + fname;
+            emit failed(location, "unable to read " + fname);
+            return;
+        }
+
+        parse(location, watcher->result());
+
+    });
+    watcher->setFuture(QtConcurrent::run([=] {
+        QFile file(fname);
+        return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+    }));
+
+}
+
+/*
+ * Parse a manifest on a pool thread, so large manifests
+ * don't block the caller's event loop. Broken manifests
+ * are neither cached nor loaded, and keep, if given, is
+ * only called on the pool thread for a good one.
+ */
+void ManifestLoader::parse(const QString &location, QByteArray content, std::function<void()> keep) {
+
+    QThread *thread = QThread::currentThread();
+    QFutureWatcher<Manifest*> *watcher = new QFutureWatcher<Manifest*>(this);
+    connect(watcher, &QFutureWatcher<Manifest*>::finished, [=] {
+        watcher->deleteLater();
+        Manifest *manifest = watcher->result();
+        if(!manifest->error.isEmpty()) {
+            QString error = manifest->error;
+            delete manifest;
+            emit failed(location, "invalid manifest: " + error);
+            return;
+        }
+        if(manifest->items.isEmpty() && manifest->servers.isEmpty()) {
+            delete manifest;
+            emit failed(location, "empty manifest");
+            return;
+        }
+        emit loaded(manifest);
+    });
+    watcher->setFuture(QtConcurrent::run([=] {
+
+        qint64 started = Metrics::now();
+
+        // Hash the manifest to easily compare to other manifests.
+        QCryptographicHash md5(QCryptographicHash::Md5);
+        md5.addData(content);
+
+        /*
+         * Only parse the XML if this exact manifest
+         * isn't already in the binary cache.
+         */
+        Manifest *manifest = ManifestCache::load(md5.result());
+        bool cached = manifest != nullptr;
+        if(!cached) {
+            QBuffer buffer;
+            buffer.setData(content);
+            buffer.open(QIODevice::ReadOnly);
+            manifest = new Manifest(&buffer, md5.result());
+            if(manifest->error.isEmpty())
+                ManifestCache::save(manifest);
+        }
+        if(keep && manifest->error.isEmpty() && (!manifest->items.isEmpty() || !manifest->servers.isEmpty()))
+            keep();
+        Metrics::record("parse", location, started, {
+            {"bytes", content.size()},
+            {"files", manifest->items.size()},
+            {"cached", cached}});
+
+        // The manifest is used from the caller's thread from now on.
+        manifest->moveToThread(thread);
+        return manifest;
+
+    }));
+
+}
+
+/*
+ * Download a manifest. The last good copy is kept, so the
+ * request can be conditional and the launcher still works
+ * when the server can't be reached.
+ */
+void ManifestLoader::download(const QUrl &url) {
+
+    /*
+     * Ask for the manifest only if it changed since the
+     * copy that's kept. A 304 response has no body, and
+     * the copy is already in the binary manifest cache.
+     */
+    QString location = url.toString();
+    QString copy = ManifestCache::downloadPath(url);
+    bool cached = QFileInfo::exists(copy);
+    QNetworkRequest req(url);
+    req.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    if(cached) {
+        QSettings meta(copy + ".meta", QSettings::IniFormat);
+        QString etag = meta.value("etag").toString();
+        QString lastModified = meta.value("lastModified").toString();
+        if(!etag.isEmpty())
+            req.setRawHeader("If-None-Match", etag.toLatin1());
+        if(!lastModified.isEmpty())
+            req.setRawHeader("If-Modified-Since", lastModified.toLatin1());
+    }
+
+    /*
+     * With a copy to fall back on, don't wait long for a
+     * server that may be unreachable. The timer stops once
+     * the response headers arrive.
+     */
+    QSettings settings;
+    qint64 started = Metrics::now();
+    QNetworkReply *res = netMan->get(req);
+    if(cached) {
+        QTimer *timeout = new QTimer(res);
+        timeout->setSingleShot(true);
+        connect(timeout, &QTimer::timeout, res, &QNetworkReply::abort);
+        connect(res, &QNetworkReply::metaDataChanged, timeout, &QTimer::stop);
+        timeout->start(settings.value("manifestTimeout", 5000).toInt());
+    }
+
+    connect (
+        res,
+        &QNetworkReply::finished,
+        [=] {
+
+           // Delete the response object to avoid memory leaks.
+           res->deleteLater();
+
+           int status = res->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+           Metrics::record("fetch", location, started, {
+               {"status", status},
+               {"bytes", res->bytesAvailable()},
+               {"error", res->error() == QNetworkReply::NoError ? QString() : res->errorString()}});
+
+           // Nothing changed, so use the copy that's kept.
+           if(cached && status == 304) {
+               qInfo() << "manifest not modified: " << url;
+               open(location, copy);
+               return;
+           }
+
+           /*
+            * Start from the kept copy if the server can't be
+            * reached, rather than parsing an error page.
+            */
+           if(res->error() != QNetworkReply::NoError) {
+               qCritical() << "manifest: " << res->errorString();
+               if(cached) {
+                   qWarning() << "using the last downloaded manifest: " << url;
+                   open(location, copy);
+               } else
+                   emit failed(location, res->errorString());
+               return;
+           }
+
+           /*
+            * Parse the XML of the manifest, and only keep it as
+            * the last good copy if it parses, so a broken one is
+            * never used again when the server says it's unchanged.
+            */
+           QByteArray body = res->readAll();
+           QByteArray etag = res->rawHeader("ETag");
+           QByteArray lastModified = res->rawHeader("Last-Modified");
+           parse(location, body, [=] {
+               ManifestCache::saveDownload(url, body, etag, lastModified);
+           });
+
+        });
+
+}
@@ -0,0 +1,36 @@
+#ifndef MANIFESTLOADER_H
+#define MANIFESTLOADER_H
+
+#include "manifest.h"
+
+#include <QObject>
+#include <QNetworkAccessManager>
+#include <QUrl>
+
+#include <functional>
+
+/*
+ * Reads manifests from the local file system or downloads
+ * them, and parses them in the background.
+ */
+class ManifestLoader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ManifestLoader(QNetworkAccessManager *netMan, QObject *parent = nullptr);
+    void load(const QString &location);
+
+signals:
+    void loaded(Manifest *manifest);
+    void failed(const QString &location, const QString &error);
+
+private:
+    QNetworkAccessManager *netMan;
+
+    void open(const QString &location, const QString &fname);
+    void download(const QUrl &url);
+    void parse(const QString &location, QByteArray content, std::function<void()> keep = nullptr);
+
+};
+
+#endif // MANIFESTLOADER_H
@@ -0,0 +1,179 @@
+#include "metrics.h"
+
+#include <QStandardPaths>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QDateTime>
+#include <QSettings>
+#include <QThread>
+#include <QMutex>
+#include <QFile>
+#include <QDir>
+
+#include <cstdio>
+
+// Log files are rotated once they grow past this size.
+static const qint64 LOG_SIZE = 4 << 20;
+
+// How many rotated log files are kept.
+static const int LOG_FILES = 3;
+
+/*
+ * Phases that happen once per file are only traced,
+ * so they don't drown out everything else in the log.
+ */
+static const QStringList TRACE_ONLY = { "hash", "queue" };
+
+static QMutex mutex;
+static QFile logFile;
+static QFile traceFile;
+static QtMessageHandler previousHandler = nullptr;
+
+/*
+ * Started on first use, so times are measured from
+ * the same moment on every thread.
+ */
+static QElapsedTimer &epoch() {
+    static QElapsedTimer timer = [] {
+        QElapsedTimer timer;
+        timer.start();
+        return timer;
+    }();
+    return timer;
+}
+
+static void rotate(const QString &fname, int count) {
+    QFile::remove(fname + "." + QString::number(count));
+    for(int i = count - 1; i > 0; i--)
+        QFile::rename(fname + "." + QString::number(i), fname + "." + QString::number(i + 1));
+    QFile::rename(fname, fname + ".1");
+}
+
+static void writeLog(const QByteArray &line) {
+
+    if(!logFile.isOpen())
+        return;
+
+    if(logFile.size() + line.size() > LOG_SIZE) {
+        QString fname = logFile.fileName();
+        logFile.close();
+        rotate(fname, LOG_FILES);
+        logFile.open(QIODevice::WriteOnly | QIODevice::Append);
+    }
+
+    logFile.write(line);
+    logFile.flush();
+
+}
+
+/*
+ * Debug messages are about single files, and only go to
+ * the console, like other per-file detail goes to the trace.
+ */
+static void handleMessage(QtMsgType type, const QMessageLogContext &context, const QString &message) {
+
+    static const char *levels[] = { "debug", "warning", "critical", "fatal", "info" };
+    QByteArray line = QDateTime::currentDateTime().toString(Qt::ISODateWithMs).toUtf8()
+            + " " + levels[type] + " " + message.toUtf8() + "\n";
+    if(type != QtDebugMsg) {
+        QMutexLocker locker(&mutex);
+        writeLog(line);
+    }
+
+    if(previousHandler)
+        previousHandler(type, context, message);
+    else
+        fputs(line.constData(), stderr);
+
+}
+
+QString Metrics::logDirectory() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/logs";
+}
+
+/*
+ * Open the log, and the trace if it's turned on in the
+ * settings. The previous run's trace is kept as ".1".
+ */
+void Metrics::start() {
+
+    QMutexLocker locker(&mutex);
+    epoch();
+
+    QDir().mkpath(logDirectory());
+    logFile.setFileName(logDirectory() + "/sweet-tea.log");
+    if(logFile.open(QIODevice::WriteOnly | QIODevice::Append))
+        previousHandler = qInstallMessageHandler(handleMessage);
+
+    QSettings settings;
+    if(settings.value("trace", false).toBool()) {
+        QString fname = logDirectory() + "/trace.json";
+        rotate(fname, 1);
+        traceFile.setFileName(fname);
+        if(traceFile.open(QIODevice::WriteOnly))
+            traceFile.write("[\n");
+    }
+
+}
+
+/*
+ * Close the trace and the log, and hand messages back to
+ * the handler that was there before, since the files go
+ * away at exit while messages may still be logged.
+ */
+void Metrics::stop() {
+
+    QMutexLocker locker(&mutex);
+    if(traceFile.isOpen()) {
+        traceFile.write("{}]\n");
+        traceFile.close();
+    }
+
+    if(logFile.isOpen()) {
+        qInstallMessageHandler(previousHandler);
+        previousHandler = nullptr;
+        logFile.close();
+    }
+
+}
+
+/*
+ * Microseconds since the metrics were started.
+ */
+qint64 Metrics::now() {
+    return epoch().nsecsElapsed() / 1000;
+}
+
+/*
+ * Record a phase that began at the given time and ends now.
+ * This can be called from any thread.
+ */
+void Metrics::record(const QString &category, const QString &name, qint64 start, const QJsonObject &args) {
+
+    qint64 duration = now() - start;
+    QMutexLocker locker(&mutex);
+
+    if(!TRACE_ONLY.contains(category)) {
+        QByteArray line = QDateTime::currentDateTime().toString(Qt::ISODateWithMs).toUtf8()
+                + " metric " + category.toUtf8() + " " + name.toUtf8()
+                + " " + QByteArray::number(duration / 1000.0, 'f', 1) + "ms "
+                + QJsonDocument(args).toJson(QJsonDocument::Compact) + "\n";
+        writeLog(line);
+    }
+
+    if(!traceFile.isOpen())
+        return;
+
+    QJsonObject event = {
+        {"name", name},
+        {"cat", category},
+        {"ph", "X"},
+        {"ts", start},
+        {"dur", duration},
+        {"pid", 1},
+        {"tid", qint64(quintptr(QThread::currentThreadId()) & 0xffffffff)},
+        {"args", args}
+    };
+    traceFile.write(QJsonDocument(event).toJson(QJsonDocument::Compact) + ",\n");
+
+}
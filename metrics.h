@@ -0,0 +1,28 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QJsonObject>
+#include <QString>
+
+/*
+ * Records how long each phase of an update took. Every
+ * message is also written to a log file that's rotated
+ * by size, and when tracing is on, each phase becomes an
+ * event in a Chrome trace (chrome://tracing, Perfetto).
+ */
+class Metrics
+{
+public:
+    static void start();
+    static void stop();
+    static qint64 now();
+    static void record (
+            const QString &category,
+            const QString &name,
+            qint64 start,
+            const QJsonObject &args = QJsonObject() );
+    static QString logDirectory();
+
+};
+
+#endif // METRICS_H
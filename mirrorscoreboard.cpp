@@ -0,0 +1,138 @@
+#include "mirrorscoreboard.h"
+
+#include <QDateTime>
+#include <QSettings>
+#include <QDebug>
+
+#include <algorithm>
+
+// How much each new sample moves the running averages.
+static const double SMOOTHING = 0.3;
+
+// Longest a failing mirror is left alone, in milliseconds.
+static const qint64 MAX_BACKOFF = 5 * 60 * 1000;
+
+MirrorScoreboard::MirrorScoreboard(QObject *parent)
+    : QObject(parent) {}
+
+void MirrorScoreboard::load() {
+
+    QSettings settings;
+    settings.beginGroup("mirrors");
+    for(const QString &host : settings.childGroups()) {
+        settings.beginGroup(host);
+        Score &score = scores[host];
+        score.latency = settings.value("latency").toDouble();
+        score.throughput = settings.value("throughput").toDouble();
+        score.errorRate = settings.value("errorRate").toDouble();
+        score.failures = settings.value("failures").toInt();
+        score.retryAt = settings.value("retryAt").toLongLong();
+        score.samples = settings.value("samples").toInt();
+        settings.endGroup();
+    }
+    settings.endGroup();
+
+}
+
+void MirrorScoreboard::save() {
+
+    QSettings settings;
+    settings.beginGroup("mirrors");
+    for(auto it = scores.constBegin(); it != scores.constEnd(); ++it) {
+        const Score &score = it.value();
+        settings.beginGroup(it.key());
+        settings.setValue("latency", score.latency);
+        settings.setValue("throughput", score.throughput);
+        settings.setValue("errorRate", score.errorRate);
+        settings.setValue("failures", score.failures);
+        settings.setValue("retryAt", score.retryAt);
+        settings.setValue("samples", score.samples);
+        settings.endGroup();
+    }
+    settings.endGroup();
+
+}
+
+/*
+ * The mirrors that can be used right now, best first.
+ * Mirrors that haven't been used yet come first, so
+ * every mirror gets measured.
+ */
+QList<QUrl> MirrorScoreboard::rank(const QList<QUrl> &urls, qint64 size) {
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QList<QUrl> usable;
+    for(const QUrl &url : urls)
+        if(scores.value(url.host()).retryAt <= now)
+            usable.append(url);
+
+    std::stable_sort(usable.begin(), usable.end(), [=](const QUrl &a, const QUrl &b) {
+        return expectedTime(a, size) < expectedTime(b, size);
+    });
+
+    return usable;
+
+}
+
+/*
+ * The soonest time any of the mirrors can be tried again.
+ */
+qint64 MirrorScoreboard::retryAt(const QList<QUrl> &urls) {
+    qint64 soonest = 0;
+    for(const QUrl &url : urls) {
+        qint64 retryAt = scores.value(url.host()).retryAt;
+        if(soonest == 0 || retryAt < soonest)
+            soonest = retryAt;
+    }
+    return soonest;
+}
+
+void MirrorScoreboard::recordSuccess(const QUrl &url, qint64 latency, qint64 bytes, qint64 elapsed) {
+
+    Score &score = scores[url.host()];
+    double throughput = double(bytes) / qMax(elapsed, qint64(1));
+    if(score.samples == 0) {
+        score.latency = latency;
+        score.throughput = throughput;
+    } else {
+        score.latency += SMOOTHING * (latency - score.latency);
+        score.throughput += SMOOTHING * (throughput - score.throughput);
+    }
+    score.errorRate *= 1 - SMOOTHING;
+    score.failures = 0;
+    score.retryAt = 0;
+    score.samples++;
+
+}
+
+/*
+ * Back off from a failing mirror, doubling the wait
+ * with each failure in a row.
+ */
+void MirrorScoreboard::recordFailure(const QUrl &url) {
+
+    Score &score = scores[url.host()];
+    score.errorRate += SMOOTHING * (1 - score.errorRate);
+    score.failures++;
+    qint64 backoff = qMin(qint64(1000) << qMin(score.failures - 1, 20), MAX_BACKOFF);
+    score.retryAt = QDateTime::currentMSecsSinceEpoch() + backoff;
+    qWarning() << "backing off from " << url.host() << " for " << backoff << "ms";
+
+}
+
+/*
+ * How long a download of the given size is expected to take,
+ * in milliseconds. Mirrors that fail often are penalized.
+ */
+double MirrorScoreboard::expectedTime(const QUrl &url, qint64 size) {
+
+    Score score = scores.value(url.host());
+
+    // Mirrors that never worked go after every other one.
+    if(score.samples == 0)
+        return score.failures * 1e12;
+
+    double time = score.latency + size / qMax(score.throughput, 1e-3);
+    return time * (1 + 4 * score.errorRate);
+
+}
@@ -0,0 +1,42 @@
+#ifndef MIRRORSCOREBOARD_H
+#define MIRRORSCOREBOARD_H
+
+#include <QObject>
+#include <QHash>
+#include <QUrl>
+
+/*
+ * Remembers how well each mirror host has done across
+ * runs, so downloads go to the fastest working mirror,
+ * and mirrors that keep failing are left alone for a
+ * while before they're tried again.
+ */
+class MirrorScoreboard : public QObject
+{
+    Q_OBJECT
+public:
+    struct Score {
+        double latency = 0;
+        double throughput = 0;
+        double errorRate = 0;
+        int failures = 0;
+        qint64 retryAt = 0;
+        int samples = 0;
+    };
+
+    explicit MirrorScoreboard(QObject *parent = nullptr);
+    void load();
+    void save();
+    QList<QUrl> rank(const QList<QUrl> &urls, qint64 size);
+    qint64 retryAt(const QList<QUrl> &urls);
+    void recordSuccess(const QUrl &url, qint64 latency, qint64 bytes, qint64 elapsed);
+    void recordFailure(const QUrl &url);
+
+private:
+    QHash<QString, Score> scores;
+
+    double expectedTime(const QUrl &url, qint64 size);
+
+};
+
+#endif // MIRRORSCOREBOARD_H
@@ -0,0 +1,237 @@
+#include "objectstore.h"
+
+#include <QtConcurrent>
+#include <QSettings>
+#include <QThread>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+ObjectStore::ObjectStore(ValidationCache *cache)
+    : cache(cache),
+      warned(0),
+      copying(0) {}
+
+/*
+ * Read where the store is from the settings. It's off
+ * unless set, and must be on the same file system as the
+ * data directory, or files can't share blocks with it.
+ */
+void ObjectStore::configure() {
+
+    QSettings settings;
+    QString location = settings.value("objectStore").toString();
+    warned.store(0);
+    copying.store(0);
+
+#ifdef Q_OS_UNIX
+    root = location.isEmpty() ? QString() : QDir::current().absoluteFilePath(location);
+#else
+    if(!location.isEmpty())
+        qWarning() << "the object store isn't supported on this platform";
+    root.clear();
+#endif
+
+}
+
+/*
+ * Put a file in place from the store, if its contents are
+ * there, and hand back whether the file is now valid. That's
+ * done right away if the store is off.
+ */
+void ObjectStore::checkout(const ManifestItem *item, QObject *context, Callback done) {
+
+    if(root.isEmpty()) {
+        done(false);
+        return;
+    }
+
+    QString root = this->root;
+    notify(QtConcurrent::run([=] {
+        return checkout(root, item);
+    }), context, done);
+
+}
+
+/*
+ * Keep a copy of a file that was just found valid, or if its
+ * contents are already stored, have the file share their
+ * blocks instead. Hands back whether the file in the data
+ * directory was replaced, right away if the store is off.
+ */
+void ObjectStore::checkin(const ManifestItem *item, bool downloaded, QObject *context, Callback done) {
+
+    if(root.isEmpty()) {
+        done(false);
+        return;
+    }
+
+    QString root = this->root;
+    notify(QtConcurrent::run([=] {
+        return checkin(root, item, downloaded);
+    }), context, done);
+
+}
+
+bool ObjectStore::checkout(const QString &root, const ManifestItem *item) {
+
+    QString object = path(root, item);
+    ValidationCache::Entry stamp;
+    if(!isValid(object, item, stamp) || !place(object, item->fname(), false, true))
+        return false;
+
+    qDebug() << item->fname() + " taken from the object store";
+    item->markValid(cache);
+    return true;
+
+}
+
+/*
+ * Stored copies are read only, and never share an inode with
+ * a file in the data directory. Without shared blocks, only
+ * downloaded files are copied in, since those are the ones
+ * another manifest would otherwise download again.
+ */
+bool ObjectStore::checkin(const QString &root, const ManifestItem *item, bool downloaded) {
+
+    if(copying.load() && !downloaded)
+        return false;
+
+    QString fname = item->fname();
+    QString object = path(root, item);
+    ValidationCache::Entry stamp;
+    if(isValid(object, item, stamp)) {
+        if(copying.load() || !place(object, fname, false, false))
+            return false;
+        item->markValid(cache);
+        return true;
+    }
+
+    if(!place(fname, object, true, downloaded))
+        return false;
+    if(ValidationCache::stat(object, stamp)) {
+        stamp.digest = item->digest();
+        cache->insert(object, stamp);
+    }
+    return false;
+
+}
+
+/*
+ * Objects are spread over directories by the first byte of
+ * their digest, so no one directory grows too large.
+ */
+QString ObjectStore::path(const QString &root, const ManifestItem *item) {
+    QString hex = QString::fromLatin1(item->digest().toHex());
+    return root + "/" + ContentHash::name(item->algorithm).toLower()
+            + "/" + hex.left(2) + "/" + hex;
+}
+
+/*
+ * Objects are only trusted while their metadata matches
+ * what it was when they were stored, the same as files.
+ */
+bool ObjectStore::isValid(const QString &object, const ManifestItem *item, ValidationCache::Entry &stamp) {
+
+    if(!ValidationCache::stat(object, stamp) || stamp.size != item->size)
+        return false;
+    stamp.digest = item->digest();
+    return cache->matches(object, stamp);
+
+}
+
+/*
+ * Replace a file with a copy of another that shares its
+ * blocks, where the file system can. Otherwise it's a plain
+ * copy, if one is allowed, but never a hard link: that would
+ * share its permissions with the file in the data directory,
+ * and a game rewriting the file would change the stored copy
+ * for every manifest. The copy is made next to the file and
+ * renamed over it, so the file is never missing or half written.
+ * Each thread uses its own temporary name, since two paths
+ * with the same contents share an object.
+ */
+bool ObjectStore::place(const QString &from, const QString &to, bool readOnly, bool copy) {
+
+#ifdef Q_OS_UNIX
+    QFileInfo(to).dir().mkpath(".");
+    QByteArray source = QFile::encodeName(from);
+    QByteArray target = QFile::encodeName(to);
+    QByteArray temp = target + "." + QByteArray::number(quintptr(QThread::currentThreadId())) + ".link";
+    mode_t mode = readOnly ? 0444 : 0644;
+    ::unlink(temp.constData());
+
+    bool placed = false;
+#ifdef FICLONE
+    int in = ::open(source.constData(), O_RDONLY | O_CLOEXEC);
+    if(in >= 0) {
+        int out = ::open(temp.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+        if(out >= 0) {
+            placed = ::ioctl(out, FICLONE, in) == 0;
+            ::close(out);
+            if(!placed)
+                ::unlink(temp.constData());
+        }
+        ::close(in);
+    }
+#endif
+
+    if(!placed && copying.testAndSetRelaxed(0, 1))
+        qInfo() << "the file system can't share blocks, so only downloaded files are copied to the object store";
+
+    if(!placed && !copy)
+        return false;
+
+    if(!placed)
+        placed = QFile::copy(from, QFile::decodeName(temp))
+                && ::chmod(temp.constData(), mode) == 0;
+
+    if(!placed || ::rename(temp.constData(), target.constData()) != 0) {
+        if(warned.testAndSetRelaxed(0, 1))
+            qWarning() << "unable to copy " << from << " to " << to << ": " << strerror(errno);
+        ::unlink(temp.constData());
+        return false;
+    }
+
+    return true;
+#else
+    Q_UNUSED(from)
+    Q_UNUSED(to)
+    Q_UNUSED(readOnly)
+    Q_UNUSED(copy)
+    return false;
+#endif
+
+}
+
+/*
+ * Hand a result from the pool back to the context's thread,
+ * unless the context is gone by then.
+ */
+void ObjectStore::notify(QFuture<bool> future, QObject *context, Callback done) {
+
+    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(context);
+    QObject::connect (
+        watcher,
+        &QFutureWatcher<bool>::finished,
+        [=] {
+            watcher->deleteLater();
+            done(watcher->result());
+        });
+    watcher->setFuture(future);
+
+}
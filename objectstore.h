@@ -0,0 +1,52 @@
+#ifndef OBJECTSTORE_H
+#define OBJECTSTORE_H
+
+#include "manifestitem.h"
+#include "validationcache.h"
+
+#include <QString>
+#include <QAtomicInt>
+#include <QFuture>
+#include <QObject>
+
+#include <functional>
+
+/*
+ * An optional store of file contents keyed by digest, shared
+ * by every manifest. Files in the data directory are copied
+ * from the stored copy, so contents already there for one
+ * manifest are never downloaded or hashed again for another.
+ * Where the file system can share blocks between files, the
+ * copies do, so the contents are only kept on disk once.
+ * Otherwise only downloaded files are stored, rather than a
+ * second copy of the whole data directory.
+ *
+ * Copying can take a while, so it's done on the thread pool,
+ * and the result handed back on the context's thread.
+ */
+class ObjectStore
+{
+public:
+    typedef std::function<void(bool)> Callback;
+
+    explicit ObjectStore(ValidationCache *cache);
+    void configure();
+    void checkout(const ManifestItem *item, QObject *context, Callback done);
+    void checkin(const ManifestItem *item, bool downloaded, QObject *context, Callback done);
+
+private:
+    ValidationCache *cache;
+    QString root;
+    QAtomicInt warned;
+    QAtomicInt copying;
+
+    bool checkout(const QString &root, const ManifestItem *item);
+    bool checkin(const QString &root, const ManifestItem *item, bool downloaded);
+    static QString path(const QString &root, const ManifestItem *item);
+    bool isValid(const QString &object, const ManifestItem *item, ValidationCache::Entry &stamp);
+    bool place(const QString &from, const QString &to, bool readOnly, bool copy);
+    static void notify(QFuture<bool> future, QObject *context, Callback done);
+
+};
+
+#endif // OBJECTSTORE_H
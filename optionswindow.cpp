@@ -20,6 +20,8 @@ OptionsWindow::OptionsWindow(QWidget *parent) :
                                QStandardPaths::writableLocation(
                                    QStandardPaths::DataLocation))
                 .toString());
+    ui->ForceRehashBox->setChecked(settings->value("forceRehash", false).toBool());
+    ui->BandwidthLimitBox->setValue(int(settings->value("bandwidthLimit", 0).toLongLong() / 1024));
 
     connect (
         ui->NewManifestLine,
@@ -70,6 +72,8 @@ OptionsWindow::OptionsWindow(QWidget *parent) :
                     ? QDir::currentPath()
                     : ui->DownloadPathLine->text();
             settings->setValue("datadir", datadir);
+            settings->setValue("forceRehash", ui->ForceRehashBox->isChecked());
+            settings->setValue("bandwidthLimit", qint64(ui->BandwidthLimitBox->value()) * 1024);
             QDir::setCurrent(ui->DownloadPathLine->text());
         });
 
@@ -0,0 +1,485 @@
+#include "packdownload.h"
+#include "filereader.h"
+#include "metrics.h"
+
+#include <QNetworkRequest>
+#include <QFileInfo>
+#include <QDir>
+#include <QDebug>
+
+#include <algorithm>
+#include <limits>
+
+/*
+ * Files closer than this are fetched as one range, since
+ * the bytes between them cost less than another part.
+ */
+static const qint64 MERGE_GAP = 1024;
+
+// Servers refuse, or merge, requests with too many ranges.
+static const int MAX_RANGES = 64;
+
+// A multipart header line longer than this is garbage.
+static const int MAX_HEADER = 8192;
+
+PackDownload::PackDownload (
+        QList<ManifestItem*> items,
+        QList<QUrl> mirrors,
+        QNetworkAccessManager *netMan,
+        TransferScheduler *scheduler,
+        MirrorScoreboard *scores,
+        ProgressTracker *progress,
+        QObject *parent )
+    : QObject(parent),
+      mirrors(mirrors),
+      netMan(netMan),
+      scheduler(scheduler),
+      scores(scores),
+      progress(progress),
+      queued(0) {
+
+    if(!items.isEmpty())
+        name = items.first()->packName();
+
+    members.reserve(items.size());
+    for(ManifestItem *item : items)
+        members.append(Member{item, item->packOffset(), item->packOffset() + item->size, 0, false, {}, {}});
+    std::sort(members.begin(), members.end(), [](const Member &a, const Member &b) {
+        return a.start < b.start;
+    });
+
+}
+
+/*
+ * Group the files into as few ranges as possible, and the
+ * ranges into requests, which are spread over the mirrors.
+ */
+void PackDownload::start() {
+
+    QList<Batch> batches;
+    Batch batch{{}, QByteArray(), 0};
+    qint64 spanStart = 0;
+    qint64 spanEnd = 0;
+    auto addSpan = [&] {
+        if(batch.count > 0)
+            batch.ranges += ",";
+        batch.ranges += QByteArray::number(spanStart) + "-" + QByteArray::number(spanEnd - 1);
+        batch.count++;
+    };
+
+    for(int i = 0; i < members.size(); i++) {
+        const Member &member = members[i];
+        if(!batch.members.isEmpty() && member.start <= spanEnd + MERGE_GAP) {
+            spanEnd = qMax(spanEnd, member.end);
+        } else {
+            if(!batch.members.isEmpty()) {
+                addSpan();
+                if(batch.count == MAX_RANGES) {
+                    batches.append(batch);
+                    batch = Batch{{}, QByteArray(), 0};
+                }
+            }
+            spanStart = member.start;
+            spanEnd = member.end;
+        }
+        batch.members.append(i);
+    }
+    if(!batch.members.isEmpty()) {
+        addSpan();
+        batches.append(batch);
+    }
+
+    if(batches.isEmpty()) {
+        emit finished();
+        return;
+    }
+
+    qInfo() << "unpacking " << members.size() << " files from " << name
+            << " in " << batches.size() << " requests";
+    queued = batches.size();
+    for(int i = 0; i < batches.size(); i++) {
+        QUrl mirror = mirrors.at(i % mirrors.size());
+        Batch next = batches[i];
+        scheduler->request(mirror, this, [=] {
+            fetch(mirror, next);
+        });
+    }
+
+}
+
+void PackDownload::fetch(const QUrl &mirror, const Batch &batch) {
+
+    QNetworkRequest req(mirror);
+    req.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    req.setRawHeader("Range", "bytes=" + batch.ranges);
+
+    QNetworkReply *reply = netMan->get(req);
+    reply->setReadBufferSize(FileReader::BUFFER_SIZE);
+    Request &request = requests[reply];
+    request.mirror = mirror;
+    request.members = batch.members;
+    request.current = 0;
+    request.ranges = batch.count;
+    request.state = Failed;
+    request.position = 0;
+    request.end = 0;
+    request.received = 0;
+    request.latency = 0;
+    request.checked = false;
+    request.timer.start();
+    request.started = Metrics::now();
+
+    connect (
+        reply,
+        &QNetworkReply::readyRead,
+        [=] {
+           receive(reply);
+        });
+    connect (
+        scheduler,
+        &TransferScheduler::refilled,
+        reply,
+        [=] {
+           receive(reply);
+        });
+    connect (
+        reply,
+        &QNetworkReply::finished,
+        [=] {
+           complete(reply);
+        });
+
+}
+
+/*
+ * Read as much as the bandwidth limit allows, or all of it
+ * once the response is over, and unpack what arrived.
+ */
+void PackDownload::receive(QNetworkReply *reply) {
+
+    auto it = requests.find(reply);
+    if(it == requests.end())
+        return;
+    Request &request = it.value();
+    if(reply->bytesAvailable() == 0)
+        return;
+
+    if(!request.checked && !check(reply, request)) {
+        qWarning() << request.mirror << "can't serve the ranges of " << name;
+        request.state = Failed;
+        reply->abort();
+        return;
+    }
+
+    QByteArray data = reply->read(scheduler->take(reply->bytesAvailable(), reply->isFinished()));
+    request.received += data.size();
+    if(request.state == End || request.state == Failed)
+        return;
+    request.buffer.append(data);
+    parse(request);
+
+    if(request.state == Failed) {
+        qWarning() << request.mirror << "sent a malformed response for " << name;
+        if(!reply->isFinished())
+            reply->abort();
+        return;
+    }
+
+    // Nothing else is needed from this response.
+    if(request.current >= request.members.size() && !reply->isFinished())
+        reply->abort();
+
+}
+
+/*
+ * Work out how the response is laid out, once, before the
+ * first bytes are read. Error pages are never unpacked.
+ */
+bool PackDownload::check(QNetworkReply *reply, Request &request) {
+
+    request.checked = true;
+    request.latency = request.timer.elapsed();
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    if(status == 200) {
+        qInfo() << request.mirror << "ignored the ranges, reading all of " << name;
+        request.state = Body;
+        request.position = 0;
+        request.end = std::numeric_limits<qint64>::max();
+        return true;
+    }
+
+    if(status != 206)
+        return false;
+
+    // Several ranges come back as parts, split by the boundary.
+    QByteArray type = reply->rawHeader("Content-Type");
+    if(type.trimmed().toLower().startsWith("multipart/byteranges")) {
+        int at = type.toLower().indexOf("boundary=");
+        if(at < 0)
+            return false;
+        QByteArray boundary = type.mid(at + 9);
+        int semicolon = boundary.indexOf(';');
+        if(semicolon >= 0)
+            boundary.truncate(semicolon);
+        boundary = boundary.trimmed();
+        if(boundary.size() >= 2 && boundary.startsWith('"') && boundary.endsWith('"'))
+            boundary = boundary.mid(1, boundary.size() - 2);
+        if(boundary.isEmpty())
+            return false;
+        request.boundary = "--" + boundary;
+        request.state = Boundary;
+        return true;
+    }
+
+    // A single range, or several the server merged into one.
+    request.state = Body;
+    return parseRange(reply->rawHeader("Content-Range"), request.position, request.end);
+
+}
+
+/*
+ * Take apart as much of the buffered response as possible.
+ * Part bodies are handed on as they arrive, and only the
+ * boundaries and part headers are kept until they're whole.
+ */
+void PackDownload::parse(Request &request) {
+
+    QByteArray &buffer = request.buffer;
+    for(;;) {
+
+        if(request.state == Body) {
+            qint64 length = qMin(qint64(buffer.size()), request.end - request.position);
+            if(length > 0) {
+                feed(request, buffer.constData(), length);
+                request.position += length;
+                buffer.remove(0, int(length));
+            }
+            if(request.position < request.end)
+                return;
+            request.state = request.boundary.isEmpty() ? End : Boundary;
+            continue;
+        }
+
+        if(request.state == Boundary) {
+            int at = buffer.indexOf(request.boundary);
+            if(at < 0) {
+                // Keep what may be the start of a boundary.
+                int keep = request.boundary.size();
+                if(buffer.size() > keep)
+                    buffer.remove(0, buffer.size() - keep);
+                return;
+            }
+            int after = at + request.boundary.size();
+            if(buffer.size() < after + 2)
+                return;
+            if(buffer.mid(after, 2) == "--") {
+                request.state = End;
+                buffer.clear();
+                return;
+            }
+            int eol = buffer.indexOf("\r\n", after);
+            if(eol < 0)
+                return;
+            buffer.remove(0, eol + 2);
+            request.end = -1;
+            request.state = Headers;
+            continue;
+        }
+
+        if(request.state == Headers) {
+            int eol = buffer.indexOf("\r\n");
+            if(eol < 0) {
+                if(buffer.size() > MAX_HEADER)
+                    request.state = Failed;
+                return;
+            }
+            QByteArray line = buffer.left(eol);
+            buffer.remove(0, eol + 2);
+
+            // The body starts after a blank line, and has to say where it's from.
+            if(line.isEmpty()) {
+                request.state = request.end >= 0 ? Body : Failed;
+                continue;
+            }
+            int colon = line.indexOf(':');
+            if(colon > 0 && line.left(colon).trimmed().toLower() == "content-range"
+                    && !parseRange(line.mid(colon + 1).trimmed(), request.position, request.end)) {
+                request.state = Failed;
+                return;
+            }
+            continue;
+        }
+
+        return;
+
+    }
+
+}
+
+/*
+ * Write the bytes of the pack that arrived, starting at the
+ * request's position, to the files they belong to. A file
+ * whose bytes went by without it being whole, or arrived
+ * out of order, isn't unpacked.
+ */
+void PackDownload::feed(Request &request, const char *data, qint64 length) {
+
+    qint64 position = request.position;
+    qint64 end = position + length;
+    for(int i = request.current; i < request.members.size(); i++) {
+        Member &member = members[request.members[i]];
+        if(member.start >= end)
+            break;
+        if(member.done)
+            continue;
+
+        qint64 from = qMax(position, member.start);
+        if(member.end <= position || from != member.start + member.written) {
+            finish(member, false);
+            continue;
+        }
+
+        qint64 to = qMin(end, member.end);
+        write(member, data + (from - position), to - from);
+        if(!member.done && member.start + member.written == member.end)
+            finish(member, true);
+    }
+
+    while(request.current < request.members.size() && members[request.members[request.current]].done)
+        request.current++;
+
+}
+
+void PackDownload::write(Member &member, const char *data, qint64 length) {
+
+    /*
+     * Files are written next to where they go, the same as
+     * other downloads, so any partial download left by one
+     * of those is replaced.
+     */
+    if(!member.part) {
+        QString fname = member.item->fname();
+        QFileInfo(fname).dir().mkpath(".");
+        QFile::remove(fname + ".part.meta");
+        member.part.reset(new QFile(fname + ".part"));
+        if(!member.part->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "failed to write to " << member.part->fileName();
+            finish(member, false);
+            return;
+        }
+        member.hash.reset(new ContentHash(member.item->algorithm));
+    }
+
+    member.hash->addData(data, length);
+    member.part->write(data, length);
+    member.written += length;
+    progress->addDownloaded(length);
+
+}
+
+/*
+ * Put a file in place if it's whole and good, or throw
+ * away what was written of it otherwise.
+ */
+void PackDownload::finish(Member &member, bool whole) {
+
+    member.done = true;
+    ManifestItem *item = member.item;
+    bool valid = whole && member.hash->result() == item->digest();
+    if(whole && !valid)
+        qWarning() << item->fname() << " in " << name << " does not match the manifest";
+
+    if(member.part) {
+        member.part->close();
+        if(valid) {
+            QFile::remove(item->fname());
+            if(!member.part->rename(item->fname())) {
+                qWarning() << "failed to write to " << item->fname();
+                valid = false;
+            }
+        }
+        if(!valid)
+            member.part->remove();
+    }
+    member.part.reset();
+    member.hash.reset();
+
+    emit unpacked(item, valid);
+
+}
+
+void PackDownload::complete(QNetworkReply *reply) {
+
+    auto it = requests.find(reply);
+    if(it == requests.end())
+        return;
+
+    // Whatever is still buffered is read regardless of the bandwidth limit.
+    if(it.value().state != Failed && it.value().current < it.value().members.size())
+        receive(reply);
+    if(!requests.contains(reply))
+        return;
+    Request request = requests.take(reply);
+    reply->deleteLater();
+    scheduler->release(request.mirror);
+
+    // The files the response didn't get to are downloaded some other way.
+    int missing = 0;
+    for(int index : request.members) {
+        Member &member = members[index];
+        if(!member.done) {
+            finish(member, false);
+            missing++;
+        }
+    }
+
+    Metrics::record("download", name, request.started, {
+        {"mirror", request.mirror.host()},
+        {"bytes", request.received},
+        {"files", request.members.size()},
+        {"ranges", request.ranges},
+        {"latencyMs", request.latency},
+        {"bytesPerSecond", request.received * 1000 / qMax(request.timer.elapsed(), qint64(1))},
+        {"error", missing > 0}});
+
+    if(missing > 0) {
+        qWarning() << request.mirror << reply->errorString();
+        scores->recordFailure(request.mirror);
+    } else {
+        scores->recordSuccess(request.mirror, request.latency, request.received, request.timer.elapsed());
+    }
+
+    if(--queued == 0)
+        emit finished();
+
+}
+
+/*
+ * Read a Content-Range value, such as "bytes 0-499/1234",
+ * into the range it covers, with the end exclusive.
+ */
+bool PackDownload::parseRange(const QByteArray &value, qint64 &start, qint64 &end) {
+
+    if(!value.startsWith("bytes "))
+        return false;
+    QByteArray range = value.mid(6);
+    int slash = range.indexOf('/');
+    if(slash >= 0)
+        range.truncate(slash);
+    int dash = range.indexOf('-');
+    if(dash < 0)
+        return false;
+
+    bool validStart = false;
+    bool validLast = false;
+    qint64 first = range.left(dash).trimmed().toLongLong(&validStart);
+    qint64 last = range.mid(dash + 1).trimmed().toLongLong(&validLast);
+    if(!validStart || !validLast || last < first)
+        return false;
+
+    start = first;
+    end = last + 1;
+    return true;
+
+}
@@ -0,0 +1,116 @@
+#ifndef PACKDOWNLOAD_H
+#define PACKDOWNLOAD_H
+
+#include "contenthash.h"
+#include "manifestitem.h"
+#include "mirrorscoreboard.h"
+#include "progresstracker.h"
+#include "transferscheduler.h"
+
+#include <QObject>
+#include <QFile>
+#include <QUrl>
+#include <QHash>
+#include <QVector>
+#include <QSharedPointer>
+#include <QElapsedTimer>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+
+/*
+ * Downloads many small manifest files from the pack they're
+ * stored in, asking for just their byte ranges in as few
+ * requests as it can. Each response is unpacked as it arrives,
+ * whether it's a multipart one with a part for every range, a
+ * single range, or the whole pack from a mirror that ignores
+ * ranges. Every file is hashed and put in place on its own,
+ * so one that fails can still be downloaded from its URLs.
+ */
+class PackDownload : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PackDownload (
+            QList<ManifestItem*> items,
+            QList<QUrl> mirrors,
+            QNetworkAccessManager *netMan,
+            TransferScheduler *scheduler,
+            MirrorScoreboard *scores,
+            ProgressTracker *progress,
+            QObject *parent = nullptr );
+    void start();
+
+signals:
+    void unpacked(ManifestItem *item, bool valid);
+    void finished();
+
+private:
+    enum State {
+        Boundary,
+        Headers,
+        Body,
+        End,
+        Failed
+    };
+
+    /*
+     * A file in the pack, where its bytes are, and the
+     * part file it's written to while they arrive.
+     */
+    struct Member {
+        ManifestItem *item;
+        qint64 start;
+        qint64 end;
+        qint64 written;
+        bool done;
+        QSharedPointer<QFile> part;
+        QSharedPointer<ContentHash> hash;
+    };
+
+    // The files asked for in one request, and their ranges.
+    struct Batch {
+        QList<int> members;
+        QByteArray ranges;
+        int count;
+    };
+
+    struct Request {
+        QUrl mirror;
+        QList<int> members;
+        int current;
+        int ranges;
+        State state;
+        QByteArray boundary;
+        QByteArray buffer;
+        qint64 position;
+        qint64 end;
+        qint64 received;
+        qint64 latency;
+        bool checked;
+        QElapsedTimer timer;
+        qint64 started;
+    };
+
+    QString name;
+    QVector<Member> members;
+    QList<QUrl> mirrors;
+    QNetworkAccessManager *netMan;
+    TransferScheduler *scheduler;
+    MirrorScoreboard *scores;
+    ProgressTracker *progress;
+    QHash<QNetworkReply*, Request> requests;
+    int queued;
+
+    void fetch(const QUrl &mirror, const Batch &batch);
+    void receive(QNetworkReply *reply);
+    bool check(QNetworkReply *reply, Request &request);
+    void parse(Request &request);
+    void feed(Request &request, const char *data, qint64 length);
+    void write(Member &member, const char *data, qint64 length);
+    void finish(Member &member, bool complete);
+    void complete(QNetworkReply *reply);
+    static bool parseRange(const QByteArray &value, qint64 &start, qint64 &end);
+
+};
+
+#endif // PACKDOWNLOAD_H
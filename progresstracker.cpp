@@ -0,0 +1,116 @@
+#include "progresstracker.h"
+
+// Snapshots are published this often by default, about 30 Hz.
+static const int DEFAULT_INTERVAL = 33;
+
+// Speed is measured over this many milliseconds.
+static const qint64 SPEED_WINDOW = 3000;
+
+ProgressTracker::ProgressTracker(QObject *parent)
+    : QObject(parent),
+      totalFiles(0),
+      lastDone(-1),
+      lastFiles(-1) {
+
+    timer.setInterval(DEFAULT_INTERVAL);
+    connect(&timer, &QTimer::timeout, this, &ProgressTracker::publish);
+
+}
+
+/*
+ * Start counting again for a new run, and publish
+ * snapshots until it's stopped.
+ */
+void ProgressTracker::reset(qint64 totalFiles, qint64 bytesToHash) {
+
+    this->totalFiles = totalFiles;
+    files = 0;
+    hashed = 0;
+    downloaded = 0;
+    total = bytesToHash;
+    lastDone = -1;
+    samples.clear();
+    clock.start();
+    timer.start();
+    publish();
+
+}
+
+void ProgressTracker::setInterval(int msec) {
+    timer.setInterval(msec);
+}
+
+/*
+ * Publish the final numbers and stop the timer.
+ */
+void ProgressTracker::stop() {
+    lastDone = -1;
+    publish();
+    timer.stop();
+}
+
+ProgressTracker::Snapshot ProgressTracker::snapshot() {
+
+    Snapshot snapshot;
+    snapshot.files = files;
+    snapshot.totalFiles = totalFiles;
+    snapshot.hashed = hashed;
+    snapshot.downloaded = downloaded;
+    snapshot.done = snapshot.hashed + snapshot.downloaded;
+    snapshot.total = qMax(qint64(total), snapshot.done);
+    snapshot.bytesPerSecond = 0;
+    snapshot.eta = -1;
+
+    if(samples.size() > 1) {
+        qint64 elapsed = samples.last().first - samples.first().first;
+        qint64 bytes = samples.last().second - samples.first().second;
+        if(elapsed > 0)
+            snapshot.bytesPerSecond = bytes * 1000 / elapsed;
+    }
+    if(snapshot.bytesPerSecond > 0)
+        snapshot.eta = (snapshot.total - snapshot.done) / snapshot.bytesPerSecond;
+
+    return snapshot;
+
+}
+
+void ProgressTracker::addHashed(qint64 bytes) {
+    hashed += bytes;
+}
+
+void ProgressTracker::addDownloaded(qint64 bytes) {
+    downloaded += bytes;
+}
+
+void ProgressTracker::addFiles(qint64 files) {
+    this->files += files;
+}
+
+/*
+ * There's more to do than the run started with, such as
+ * a file that failed validation and is downloaded.
+ */
+void ProgressTracker::expect(qint64 bytes) {
+    total += bytes;
+}
+
+/*
+ * Sample the counters, and publish a snapshot if
+ * anything changed since the last one.
+ */
+void ProgressTracker::publish() {
+
+    qint64 now = clock.elapsed();
+    qint64 done = hashed + downloaded;
+    samples.enqueue(qMakePair(now, done));
+    while(samples.size() > 2 && now - samples.first().first > SPEED_WINDOW)
+        samples.dequeue();
+
+    if(done == lastDone && files == lastFiles)
+        return;
+    lastDone = done;
+    lastFiles = files;
+
+    emit updated(snapshot());
+
+}
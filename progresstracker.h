@@ -0,0 +1,66 @@
+#ifndef PROGRESSTRACKER_H
+#define PROGRESSTRACKER_H
+
+#include <QObject>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QMetaType>
+#include <QQueue>
+#include <QPair>
+#include <QTimer>
+
+/*
+ * Adds up the bytes hashed and downloaded by every worker,
+ * and publishes a snapshot of them a few times a second,
+ * rather than once for every file. Workers may report from
+ * any thread.
+ */
+class ProgressTracker : public QObject
+{
+    Q_OBJECT
+public:
+    struct Snapshot {
+        qint64 files;
+        qint64 totalFiles;
+        qint64 hashed;
+        qint64 downloaded;
+        qint64 done;
+        qint64 total;
+        qint64 bytesPerSecond;
+        // Seconds left, or -1 while it can't be told yet.
+        qint64 eta;
+    };
+
+    explicit ProgressTracker(QObject *parent = nullptr);
+    void reset(qint64 totalFiles, qint64 bytesToHash);
+    void setInterval(int msec);
+    void stop();
+    Snapshot snapshot();
+
+    void addHashed(qint64 bytes);
+    void addDownloaded(qint64 bytes);
+    void addFiles(qint64 files);
+    void expect(qint64 bytes);
+
+signals:
+    void updated(const ProgressTracker::Snapshot &snapshot);
+
+private:
+    QAtomicInteger<qint64> files;
+    QAtomicInteger<qint64> hashed;
+    QAtomicInteger<qint64> downloaded;
+    QAtomicInteger<qint64> total;
+    qint64 totalFiles;
+    qint64 lastDone;
+    qint64 lastFiles;
+    QTimer timer;
+    QElapsedTimer clock;
+    QQueue<QPair<qint64, qint64>> samples;
+
+    void publish();
+
+};
+
+Q_DECLARE_METATYPE(ProgressTracker::Snapshot)
+
+#endif // PROGRESSTRACKER_H
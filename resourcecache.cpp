@@ -0,0 +1,135 @@
+#include "resourcecache.h"
+
+#include <QNetworkDiskCache>
+#include <QNetworkRequest>
+#include <QStandardPaths>
+#include <QDateTime>
+#include <QScopedPointer>
+#include <QDebug>
+
+// Responses kept on disk, in bytes.
+static const qint64 DISK_CACHE_SIZE = 32 << 20;
+
+// How long a fetched resource is used without asking again, in milliseconds.
+static const qint64 MEMORY_TTL = 5 * 60 * 1000;
+
+static const char USER_AGENT[] = "Sweet Tea / 1.2.0";
+
+ResourceCache::ResourceCache(QObject *parent)
+    : QObject(parent),
+      disk(new QNetworkDiskCache) {
+
+    disk->setCacheDirectory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/resources");
+    disk->setMaximumCacheSize(DISK_CACHE_SIZE);
+
+    // The network manager takes ownership of the cache.
+    netMan.setCache(disk);
+
+}
+
+/*
+ * Fetch a resource, or use the copy fetched a moment ago.
+ * Otherwise, what's on disk is handed over right away, then
+ * again once the server was asked, if it has changed.
+ */
+void ResourceCache::fetch(const QUrl &url, QObject *context, DataCallback done, ErrorCallback failed) {
+
+    Waiter waiter{context, done, failed, false, QByteArray()};
+
+    auto entry = entries.constFind(url);
+    if(entry != entries.constEnd()) {
+        if(QDateTime::currentMSecsSinceEpoch() - entry->fetched < MEMORY_TTL) {
+            done(entry->data);
+            return;
+        }
+        waiter.shown = true;
+        waiter.data = entry->data;
+    } else {
+        QScopedPointer<QIODevice> cached(disk->data(url));
+        if(cached) {
+            waiter.shown = true;
+            waiter.data = cached->readAll();
+            entries.insert(url, Entry{waiter.data, 0});
+        }
+    }
+
+    if(waiter.shown)
+        done(waiter.data);
+
+    // Wait for the request already made for the same URL.
+    bool inFlight = waiting.contains(url);
+    waiting[url].append(waiter);
+    if(inFlight)
+        return;
+
+    QNetworkRequest req(url);
+    req.setHeader(QNetworkRequest::UserAgentHeader, USER_AGENT);
+    req.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    // Use what's on disk while its headers say it's fresh, and revalidate it once stale.
+    req.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork);
+    QNetworkReply *reply = netMan.get(req);
+    connect (
+        reply,
+        &QNetworkReply::finished,
+        this,
+        [=] {
+            finish(url, reply);
+        });
+
+}
+
+/*
+ * Fetch an image, decoding it only once for as
+ * long as it doesn't change.
+ */
+void ResourceCache::fetchPixmap(const QUrl &url, QObject *context, PixmapCallback done, ErrorCallback failed) {
+
+    fetch(url, context, [=](const QByteArray &data) {
+        QPixmap pixmap = pixmaps.value(url);
+        if(pixmap.isNull()) {
+            if(!pixmap.loadFromData(data)) {
+                failed("unable to read image: " + url.toString());
+                return;
+            }
+            pixmaps.insert(url, pixmap);
+        }
+        done(pixmap);
+    }, failed);
+
+}
+
+/*
+ * Hand a response to everyone waiting for it. A failure
+ * is only reported to those that weren't given a copy from
+ * disk, which is better than nothing.
+ */
+void ResourceCache::finish(const QUrl &url, QNetworkReply *reply) {
+
+    reply->deleteLater();
+    QList<Waiter> waiters = waiting.take(url);
+
+    if(reply->error() != QNetworkReply::NoError) {
+        QString error = reply->errorString();
+        qWarning() << url.toString() << ": " << error;
+        for(const Waiter &waiter : waiters)
+            if(waiter.context && !waiter.shown)
+                waiter.failed(error);
+        return;
+    }
+
+    QByteArray data = reply->readAll();
+    store(url, data);
+    for(const Waiter &waiter : waiters)
+        if(waiter.context && (!waiter.shown || waiter.data != data))
+            waiter.done(data);
+
+}
+
+void ResourceCache::store(const QUrl &url, const QByteArray &data) {
+
+    auto entry = entries.constFind(url);
+    if(entry == entries.constEnd() || entry->data != data)
+        pixmaps.remove(url);
+    entries.insert(url, Entry{data, QDateTime::currentMSecsSinceEpoch()});
+
+}
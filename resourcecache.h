@@ -0,0 +1,62 @@
+#ifndef RESOURCECACHE_H
+#define RESOURCECACHE_H
+
+#include <QObject>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QPointer>
+#include <QPixmap>
+#include <QHash>
+#include <QUrl>
+
+#include <functional>
+
+class QNetworkDiskCache;
+
+/*
+ * Fetches small resources, such as launch profile icons and
+ * messages of the day. Responses are kept on disk and checked
+ * with the server before they're used again, decoded images are
+ * kept in memory, and a URL that's already being fetched shares
+ * that request. Callbacks only run while their context is alive,
+ * and may run twice: once with what's on disk, and again if the
+ * server has something newer.
+ */
+class ResourceCache : public QObject
+{
+    Q_OBJECT
+public:
+    typedef std::function<void(const QByteArray &data)> DataCallback;
+    typedef std::function<void(const QPixmap &pixmap)> PixmapCallback;
+    typedef std::function<void(const QString &error)> ErrorCallback;
+
+    explicit ResourceCache(QObject *parent = nullptr);
+    void fetch(const QUrl &url, QObject *context, DataCallback done, ErrorCallback failed);
+    void fetchPixmap(const QUrl &url, QObject *context, PixmapCallback done, ErrorCallback failed);
+
+private:
+    struct Entry {
+        QByteArray data;
+        qint64 fetched;
+    };
+
+    struct Waiter {
+        QPointer<QObject> context;
+        DataCallback done;
+        ErrorCallback failed;
+        bool shown;
+        QByteArray data;
+    };
+
+    QNetworkAccessManager netMan;
+    QNetworkDiskCache *disk;
+    QHash<QUrl, Entry> entries;
+    QHash<QUrl, QPixmap> pixmaps;
+    QHash<QUrl, QList<Waiter>> waiting;
+
+    void finish(const QUrl &url, QNetworkReply *reply);
+    void store(const QUrl &url, const QByteArray &data);
+
+};
+
+#endif // RESOURCECACHE_H
@@ -0,0 +1,309 @@
+#include "segmenteddownload.h"
+#include "filereader.h"
+#include "metrics.h"
+
+#include <QtConcurrent>
+#include <QNetworkRequest>
+#include <QFileInfo>
+#include <QDir>
+#include <QDebug>
+
+// Ranges smaller than this aren't worth splitting between mirrors.
+static const qint64 MIN_STEAL = 1 << 20;
+
+SegmentedDownload::SegmentedDownload (
+        ManifestItem *item,
+        QList<QUrl> mirrors,
+        QNetworkAccessManager *netMan,
+        TransferScheduler *scheduler,
+        MirrorScoreboard *scores,
+        ProgressTracker *progress,
+        QObject *parent )
+    : QObject(parent),
+      item(item),
+      mirrors(mirrors),
+      netMan(netMan),
+      scheduler(scheduler),
+      scores(scores),
+      progress(progress),
+      part(item->fname() + ".part"),
+      done(false) {}
+
+void SegmentedDownload::start() {
+
+    /*
+     * Any partial file from a single mirror download can't be
+     * resumed here, so the file is started over at full size.
+     */
+    QFileInfo(item->fname()).dir().mkpath(".");
+    QFile::remove(item->fname() + ".part.meta");
+    if(!part.open(QIODevice::ReadWrite) || !part.resize(item->size)) {
+        qWarning() << "failed to write to " << part.fileName();
+        emit finished(false);
+        return;
+    }
+
+    for(qint64 start = 0; start < item->size; start += SEGMENT_SIZE)
+        pending.append(Segment{start, qMin(start + SEGMENT_SIZE, qint64(item->size))});
+
+    qInfo() << "downloading " << item->fname() << " from " << mirrors.size() << " mirrors";
+    for(const QUrl &mirror : mirrors)
+        next(mirror);
+
+}
+
+/*
+ * Queue the next request to a mirror. The range
+ * is picked once the scheduler lets it start.
+ */
+void SegmentedDownload::next(QUrl mirror) {
+    if(done)
+        return;
+    scheduler->request(mirror, this, [=] {
+        fetch(mirror);
+    });
+}
+
+/*
+ * Give a mirror the next range to download, or leave it
+ * idle if there's nothing left for it to do.
+ */
+void SegmentedDownload::fetch(QUrl mirror) {
+
+    if(done) {
+        scheduler->release(mirror);
+        return;
+    }
+
+    Segment segment;
+    if(!pending.isEmpty())
+        segment = pending.takeFirst();
+    else if(!steal(segment)) {
+        scheduler->release(mirror);
+        idle.append(mirror);
+        if(transfers.isEmpty())
+            verify();
+        return;
+    }
+
+    QNetworkRequest req(mirror);
+    req.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    req.setRawHeader("Range", "bytes="
+                     + QByteArray::number(segment.start) + "-"
+                     + QByteArray::number(segment.end - 1));
+
+    QNetworkReply *reply = netMan->get(req);
+    reply->setReadBufferSize(FileReader::BUFFER_SIZE);
+    Transfer &transfer = transfers[reply];
+    transfer.mirror = mirror;
+    transfer.begin = segment.start;
+    transfer.position = segment.start;
+    transfer.end = segment.end;
+    transfer.latency = 0;
+    transfer.checked = false;
+    transfer.aborted = false;
+    transfer.timer.start();
+    transfer.started = Metrics::now();
+
+    connect (
+        reply,
+        &QNetworkReply::readyRead,
+        [=] {
+           receive(reply);
+        });
+    connect (
+        scheduler,
+        &TransferScheduler::refilled,
+        reply,
+        [=] {
+           receive(reply);
+        });
+    connect (
+        reply,
+        &QNetworkReply::finished,
+        [=] {
+           complete(reply);
+        });
+
+}
+
+/*
+ * Split off the second half of the range that's expected to
+ * finish last, based on how fast its mirror has been so far.
+ */
+bool SegmentedDownload::steal(Segment &segment) {
+
+    Transfer *slowest = nullptr;
+    double slowestTime = 0;
+    for(Transfer &transfer : transfers) {
+        qint64 remaining = transfer.end - transfer.position;
+        if(remaining < MIN_STEAL * 2)
+            continue;
+        double rate = double(transfer.position - transfer.begin + 1) / (transfer.timer.elapsed() + 1);
+        double time = remaining / rate;
+        if(!slowest || time > slowestTime) {
+            slowest = &transfer;
+            slowestTime = time;
+        }
+    }
+
+    if(!slowest)
+        return false;
+
+    qint64 middle = slowest->position + (slowest->end - slowest->position) / 2;
+    segment = {middle, slowest->end};
+    slowest->end = middle;
+    return true;
+
+}
+
+void SegmentedDownload::receive(QNetworkReply *reply) {
+
+    auto it = transfers.find(reply);
+    if(it == transfers.end())
+        return;
+    Transfer &transfer = it.value();
+    if(reply->bytesAvailable() == 0)
+        return;
+
+    /*
+     * A mirror that ignores the range would send the whole
+     * file, so it can't be used for this download.
+     */
+    if(!transfer.checked) {
+        transfer.checked = true;
+        transfer.latency = transfer.timer.elapsed();
+        int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        QByteArray range = "bytes " + QByteArray::number(transfer.position) + "-";
+        if(status != 206 || !reply->rawHeader("Content-Range").startsWith(range)) {
+            qWarning() << transfer.mirror << "does not support range requests";
+            transfer.aborted = true;
+            reply->abort();
+            return;
+        }
+    }
+
+    // Read as much as the bandwidth limit allows, or all of it once the range is over.
+    qint64 wanted = qMin(reply->bytesAvailable(), transfer.end - transfer.position);
+    QByteArray data = reply->read(scheduler->take(wanted, reply->isFinished()));
+    part.seek(transfer.position);
+    part.write(data);
+    transfer.position += data.size();
+    progress->addDownloaded(data.size());
+
+    // The end of this range was handed to another mirror.
+    if(transfer.position >= transfer.end) {
+        transfer.aborted = true;
+        reply->abort();
+    }
+
+}
+
+void SegmentedDownload::complete(QNetworkReply *reply) {
+
+    /*
+     * Write anything that's left, unless the range was rejected
+     * or the reply was aborted, which finishes it from inside
+     * receive() with nothing left to read.
+     */
+    if(!transfers.contains(reply))
+        return;
+    if(transfers[reply].checked && !transfers[reply].aborted)
+        receive(reply);
+    if(!transfers.contains(reply))
+        return;
+    Transfer transfer = transfers.take(reply);
+    reply->deleteLater();
+    scheduler->release(transfer.mirror);
+
+    qint64 bytes = transfer.position - transfer.begin;
+    Metrics::record("download", item->fname(), transfer.started, {
+        {"mirror", transfer.mirror.host()},
+        {"bytes", bytes},
+        {"offset", transfer.begin},
+        {"latencyMs", transfer.latency},
+        {"bytesPerSecond", bytes * 1000 / qMax(transfer.timer.elapsed(), qint64(1))},
+        {"error", transfer.position < transfer.end}});
+
+    if(transfer.position >= transfer.end) {
+        scores->recordSuccess(transfer.mirror, transfer.latency, transfer.position - transfer.begin, transfer.timer.elapsed());
+        next(transfer.mirror);
+        return;
+    }
+
+    /*
+     * Put what's left of the range back, and stop using the
+     * mirror. Wake up any idle mirrors to pick it up.
+     */
+    qWarning() << transfer.mirror << reply->errorString();
+    scores->recordFailure(transfer.mirror);
+    mirrors.removeAll(transfer.mirror);
+    pending.prepend(Segment{transfer.position, transfer.end});
+
+    if(mirrors.isEmpty()) {
+        if(done)
+            return;
+        done = true;
+        for(QNetworkReply *other : transfers.keys())
+            other->abort();
+        part.close();
+        part.remove();
+        emit finished(false);
+        return;
+    }
+
+    QList<QUrl> waiting = idle;
+    idle.clear();
+    for(const QUrl &mirror : waiting)
+        next(mirror);
+
+}
+
+/*
+ * Hash the assembled file on a pool thread, since it
+ * couldn't be hashed in order while it was downloaded.
+ */
+void SegmentedDownload::verify() {
+
+    if(done)
+        return;
+    done = true;
+    part.close();
+
+    QString fname = part.fileName();
+    ManifestItem *item = this->item;
+    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, [=] {
+
+        watcher->deleteLater();
+        if(!watcher->result()) {
+            qWarning() << item->fname() << "does not match the manifest";
+            QFile::remove(fname);
+            emit finished(false);
+            return;
+        }
+
+        QFile::remove(item->fname());
+        if(!QFile::rename(fname, item->fname())) {
+            qWarning() << "failed to write to " << item->fname();
+            QFile::remove(fname);
+            emit finished(false);
+            return;
+        }
+
+        emit finished(true);
+
+    });
+    watcher->setFuture(QtConcurrent::run([=] {
+        qint64 started = Metrics::now();
+        ContentHash hash(item->algorithm);
+        bool valid = FileReader::read(fname, hash)
+                && hash.result() == item->digest();
+        Metrics::record("hash", item->fname(), started, {
+            {"bytes", item->size},
+            {"algorithm", ContentHash::name(item->algorithm)},
+            {"valid", valid}});
+        return valid;
+    }));
+
+}
@@ -0,0 +1,83 @@
+#ifndef SEGMENTEDDOWNLOAD_H
+#define SEGMENTEDDOWNLOAD_H
+
+#include "manifestitem.h"
+#include "mirrorscoreboard.h"
+#include "progresstracker.h"
+#include "transferscheduler.h"
+
+#include <QObject>
+#include <QFile>
+#include <QUrl>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+
+/*
+ * Downloads a large manifest file from several mirrors at
+ * once. The file is split into ranges, each mirror fetches
+ * one range at a time, and every range is written at its
+ * offset in a file that's sized up front. When there's
+ * nothing left to hand out, a mirror that's idle takes
+ * over half of the range that will take longest to finish.
+ */
+class SegmentedDownload : public QObject
+{
+    Q_OBJECT
+public:
+    static const qint64 SEGMENT_SIZE = 4 << 20;
+
+    explicit SegmentedDownload (
+            ManifestItem *item,
+            QList<QUrl> mirrors,
+            QNetworkAccessManager *netMan,
+            TransferScheduler *scheduler,
+            MirrorScoreboard *scores,
+            ProgressTracker *progress,
+            QObject *parent = nullptr );
+    void start();
+
+signals:
+    void finished(bool valid);
+
+private:
+    struct Segment {
+        qint64 start;
+        qint64 end;
+    };
+
+    struct Transfer {
+        QUrl mirror;
+        qint64 begin;
+        qint64 position;
+        qint64 end;
+        qint64 latency;
+        bool checked;
+        bool aborted;
+        QElapsedTimer timer;
+        qint64 started;
+    };
+
+    ManifestItem *item;
+    QList<QUrl> mirrors;
+    QList<QUrl> idle;
+    QNetworkAccessManager *netMan;
+    TransferScheduler *scheduler;
+    MirrorScoreboard *scores;
+    ProgressTracker *progress;
+    QFile part;
+    QList<Segment> pending;
+    QHash<QNetworkReply*, Transfer> transfers;
+    bool done;
+
+    void next(QUrl mirror);
+    void fetch(QUrl mirror);
+    bool steal(Segment &segment);
+    void receive(QNetworkReply *reply);
+    void complete(QNetworkReply *reply);
+    void verify();
+
+};
+
+#endif // SEGMENTEDDOWNLOAD_H
@@ -0,0 +1,156 @@
+#include "streamdecoder.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static const int CHUNK_SIZE = 1 << 18;
+
+StreamDecoder::StreamDecoder(Encoding encoding)
+    : encoding(encoding),
+      state(nullptr) {
+
+    switch(encoding) {
+#ifdef HAVE_ZLIB
+    case Gzip: {
+        z_stream *stream = new z_stream();
+        // Adding 16 to the window bits expects a gzip header.
+        if(inflateInit2(stream, 16 + MAX_WBITS) == Z_OK)
+            state = stream;
+        else
+            delete stream;
+        break;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case Zstd:
+        state = ZSTD_createDStream();
+        break;
+#endif
+    default:
+        break;
+    }
+
+    if(encoding != Identity)
+        buffer.resize(CHUNK_SIZE);
+
+}
+
+StreamDecoder::~StreamDecoder() {
+
+    if(!state)
+        return;
+
+    switch(encoding) {
+#ifdef HAVE_ZLIB
+    case Gzip:
+        inflateEnd(static_cast<z_stream*>(state));
+        delete static_cast<z_stream*>(state);
+        break;
+#endif
+#ifdef HAVE_ZSTD
+    case Zstd:
+        ZSTD_freeDStream(static_cast<ZSTD_DStream*>(state));
+        break;
+#endif
+    default:
+        break;
+    }
+
+}
+
+/*
+ * Decompress the next chunk of input, appending whatever
+ * comes out to the output. Returns false if the input is
+ * corrupt or the encoding isn't supported.
+ */
+bool StreamDecoder::decode(const QByteArray &input, QByteArray &output) {
+
+    if(encoding == Identity) {
+        output.append(input);
+        return true;
+    }
+
+    if(!state)
+        return false;
+
+    switch(encoding) {
+#ifdef HAVE_ZLIB
+    case Gzip: {
+        z_stream *stream = static_cast<z_stream*>(state);
+        stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.constData()));
+        stream->avail_in = uInt(input.size());
+        do {
+            stream->next_out = reinterpret_cast<Bytef*>(buffer.data());
+            stream->avail_out = uInt(buffer.size());
+            int result = inflate(stream, Z_NO_FLUSH);
+            if(result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+                return false;
+            output.append(buffer.constData(), buffer.size() - int(stream->avail_out));
+
+            // Files can be made of several gzip members back to back.
+            if(result == Z_STREAM_END && stream->avail_in > 0)
+                inflateReset(stream);
+            else if(result != Z_OK)
+                break;
+        } while(stream->avail_in > 0 || stream->avail_out == 0);
+        return true;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case Zstd: {
+        ZSTD_inBuffer in = { input.constData(), size_t(input.size()), 0 };
+        for(;;) {
+            ZSTD_outBuffer out = { buffer.data(), size_t(buffer.size()), 0 };
+            size_t result = ZSTD_decompressStream(static_cast<ZSTD_DStream*>(state), &out, &in);
+            if(ZSTD_isError(result))
+                return false;
+            output.append(buffer.constData(), int(out.pos));
+            if(in.pos == in.size && out.pos < out.size)
+                break;
+        }
+        return true;
+    }
+#endif
+    default:
+        return false;
+    }
+
+}
+
+bool StreamDecoder::fromName(const QString &name, Encoding &encoding) {
+
+    QString lower = name.trimmed().toLower();
+    if(lower.isEmpty() || lower == "identity")
+        encoding = Identity;
+    else if(lower == "gzip")
+        encoding = Gzip;
+    else if(lower == "zstd")
+        encoding = Zstd;
+    else
+        return false;
+
+    return true;
+
+}
+
+bool StreamDecoder::isSupported(Encoding encoding) {
+    switch(encoding) {
+#ifdef HAVE_ZLIB
+    case Gzip:
+        return true;
+#endif
+#ifdef HAVE_ZSTD
+    case Zstd:
+        return true;
+#endif
+    case Identity:
+        return true;
+    default:
+        return false;
+    }
+}
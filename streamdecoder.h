@@ -0,0 +1,37 @@
+#ifndef STREAMDECODER_H
+#define STREAMDECODER_H
+
+#include <QByteArray>
+#include <QString>
+
+/*
+ * Decompresses a download a chunk at a time as it
+ * arrives, so compressed files never have to be held
+ * in memory or written to disk as a whole.
+ */
+class StreamDecoder
+{
+public:
+    enum Encoding : quint8 {
+        Identity,
+        Gzip,
+        Zstd
+    };
+
+    explicit StreamDecoder(Encoding encoding);
+    ~StreamDecoder();
+    bool decode(const QByteArray &input, QByteArray &output);
+
+    static bool fromName(const QString &name, Encoding &encoding);
+    static bool isSupported(Encoding encoding);
+
+private:
+    Q_DISABLE_COPY(StreamDecoder)
+
+    Encoding encoding;
+    QByteArray buffer;
+    void *state;
+
+};
+
+#endif // STREAMDECODER_H
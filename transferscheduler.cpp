@@ -0,0 +1,202 @@
+#include "transferscheduler.h"
+#include "metrics.h"
+
+#include <QSettings>
+#include <QDebug>
+
+// How often the bandwidth budget is topped up, in milliseconds.
+static const int REFILL_INTERVAL = 50;
+
+// How often the global limit is tuned, in milliseconds.
+static const int TUNE_INTERVAL = 2000;
+
+TransferScheduler::TransferScheduler(QObject *parent)
+    : QObject(parent),
+      nextHost(0),
+      active(0),
+      limit(1),
+      maxLimit(1),
+      hostLimit(1),
+      dispatching(false),
+      bandwidth(0),
+      budget(0),
+      windowBytes(0),
+      lastThroughput(0),
+      direction(1) {
+
+    connect(&refillTimer, &QTimer::timeout, this, &TransferScheduler::refill);
+    connect(&tuneTimer, &QTimer::timeout, this, &TransferScheduler::tune);
+    configure();
+
+}
+
+/*
+ * Read the limits from the settings.
+ */
+void TransferScheduler::configure() {
+
+    QSettings settings;
+    maxLimit = qMax(1, settings.value("maxDownloads", 32).toInt());
+    hostLimit = qMax(1, settings.value("hostDownloads", 6).toInt());
+    limit = qBound(1, settings.value("downloads", 8).toInt(), maxLimit);
+    bandwidth = qMax(qint64(0), settings.value("bandwidthLimit", 0).toLongLong());
+
+    if(bandwidth > 0) {
+        budget = bandwidth * REFILL_INTERVAL / 1000;
+        refillClock.start();
+        refillTimer.start(REFILL_INTERVAL);
+    } else
+        refillTimer.stop();
+
+    windowBytes = 0;
+    lastThroughput = 0;
+    tuneClock.start();
+    tuneTimer.start(TUNE_INTERVAL);
+
+}
+
+/*
+ * Queue a transfer. The start function is called once there's
+ * room for it, unless the context was deleted first. Every
+ * transfer that starts has to be released when it's done.
+ */
+void TransferScheduler::request(const QUrl &url, QObject *context, std::function<void()> start) {
+
+    QString host = url.host();
+    if(!queues.contains(host))
+        hosts.append(host);
+
+    // Record how long the transfer waited for a slot.
+    qint64 queued = Metrics::now();
+    queues[host].enqueue({context, [=] {
+        Metrics::record("queue", "transfer", queued, {{"host", host}});
+        start();
+    }});
+    dispatch();
+
+}
+
+void TransferScheduler::release(const QUrl &url) {
+
+    QString host = url.host();
+    active--;
+    if(--hostActive[host] <= 0)
+        hostActive.remove(host);
+    dispatch();
+
+}
+
+/*
+ * How many of the wanted bytes may be read now. Forced
+ * reads are always allowed, but still use up the budget.
+ */
+qint64 TransferScheduler::take(qint64 wanted, bool force) {
+
+    if(bandwidth > 0) {
+        if(!force)
+            wanted = qBound(qint64(0), wanted, budget);
+        budget -= wanted;
+    }
+
+    windowBytes += wanted;
+    return wanted;
+
+}
+
+/*
+ * Drop every transfer that hasn't started yet.
+ */
+void TransferScheduler::cancel() {
+    queues.clear();
+    hosts.clear();
+    nextHost = 0;
+}
+
+/*
+ * Start queued transfers while there's room, taking turns
+ * between hosts. Transfers that fail right away release
+ * their slot from inside their start function, so calls
+ * made while dispatching are left to the outer loop.
+ */
+void TransferScheduler::dispatch() {
+
+    if(dispatching)
+        return;
+    dispatching = true;
+
+    int skipped = 0;
+    while(active < limit && !hosts.isEmpty() && skipped < hosts.size()) {
+
+        nextHost %= hosts.size();
+        QString host = hosts[nextHost];
+        if(hostActive.value(host) >= hostLimit) {
+            nextHost++;
+            skipped++;
+            continue;
+        }
+        skipped = 0;
+
+        QQueue<Pending> &queue = queues[host];
+        Pending pending = queue.dequeue();
+        if(queue.isEmpty()) {
+            queues.remove(host);
+            hosts.removeAt(nextHost);
+        } else
+            nextHost++;
+
+        if(!pending.context)
+            continue;
+
+        active++;
+        hostActive[host]++;
+        pending.start();
+
+    }
+
+    dispatching = false;
+
+}
+
+/*
+ * Top up the bandwidth budget, holding at most a quarter
+ * second's worth so the limit isn't exceeded in bursts.
+ */
+void TransferScheduler::refill() {
+    budget = qMin(budget + bandwidth * refillClock.restart() / 1000, qMax(bandwidth / 4, qint64(1)));
+    emit refilled();
+}
+
+/*
+ * Move the global limit one step at a time in whichever
+ * direction made the total throughput go up, and turn
+ * around when it drops. The limit is only tuned while
+ * transfers are waiting for room.
+ */
+void TransferScheduler::tune() {
+
+    double throughput = double(windowBytes) / qMax(tuneClock.restart(), qint64(1));
+    windowBytes = 0;
+
+    if(hosts.isEmpty()) {
+        lastThroughput = 0;
+        return;
+    }
+
+    if(lastThroughput > 0) {
+        if(throughput < lastThroughput * 0.95)
+            direction = -direction;
+        else if(throughput <= lastThroughput * 1.05) {
+            lastThroughput = throughput;
+            return;
+        }
+    }
+
+    int previous = limit;
+    limit = qBound(1, limit + direction, maxLimit);
+    lastThroughput = throughput;
+    if(limit != previous)
+        qInfo() << "download limit: " << limit << " at " << throughput << "KB/s";
+
+    dispatch();
+
+}
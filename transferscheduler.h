@@ -0,0 +1,67 @@
+#ifndef TRANSFERSCHEDULER_H
+#define TRANSFERSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QQueue>
+#include <QPointer>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QUrl>
+
+#include <functional>
+
+/*
+ * Decides when each download may start. It keeps the number
+ * of transfers in flight under a global and a per-host limit,
+ * caps the bandwidth they use, and tunes the global limit to
+ * whatever gives the best measured throughput.
+ */
+class TransferScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TransferScheduler(QObject *parent = nullptr);
+    void configure();
+    void request(const QUrl &url, QObject *context, std::function<void()> start);
+    void release(const QUrl &url);
+    qint64 take(qint64 wanted, bool force = false);
+    void cancel();
+
+signals:
+    void refilled();
+
+private:
+    struct Pending {
+        QPointer<QObject> context;
+        std::function<void()> start;
+    };
+
+    QHash<QString, QQueue<Pending>> queues;
+    QStringList hosts;
+    QHash<QString, int> hostActive;
+    int nextHost;
+    int active;
+    int limit;
+    int maxLimit;
+    int hostLimit;
+    bool dispatching;
+
+    qint64 bandwidth;
+    qint64 budget;
+    QTimer refillTimer;
+    QElapsedTimer refillClock;
+
+    qint64 windowBytes;
+    double lastThroughput;
+    int direction;
+    QTimer tuneTimer;
+    QElapsedTimer tuneClock;
+
+    void dispatch();
+    void refill();
+    void tune();
+
+};
+
+#endif // TRANSFERSCHEDULER_H
@@ -0,0 +1,651 @@
+#include "updater.h"
+#include "manifestcache.h"
+#include "filedownload.h"
+#include "segmenteddownload.h"
+#include "packdownload.h"
+
+#include <QtConcurrent>
+#include <QStandardPaths>
+#include <QSettings>
+#include <QDateTime>
+#include <QTimer>
+#include <QDebug>
+
+// How long files are gathered before their packs are fetched, in milliseconds.
+static const int PACK_DELAY = 200;
+
+Updater::Updater(QNetworkAccessManager *netMan, QObject *parent)
+    : QObject(parent),
+      currentFiles(0),
+      maxFiles(0),
+      netMan(netMan),
+      manifest(nullptr),
+      validated(nullptr),
+      cache(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/validation.cache"),
+      store(&cache),
+      validator(&cache, &progress),
+      runs(0),
+      background(false),
+      paused(false),
+      watchedClean(false) {
+
+    cache.load();
+    store.configure();
+    mirrorScores.load();
+
+    /*
+     * Count or download each file as the
+     * validator finishes hashing it.
+     */
+    connect (
+        &validator,
+        &ValidationScheduler::validated,
+        this,
+        &Updater::itemValidated);
+
+    packTimer.setSingleShot(true);
+    packTimer.setInterval(PACK_DELAY);
+    connect (
+        &packTimer,
+        &QTimer::timeout,
+        this,
+        &Updater::downloadPacks);
+
+}
+
+/*
+ * Apply changed download settings.
+ */
+void Updater::configure() {
+    transfers.configure();
+    store.configure();
+}
+
+/*
+ * Keep track of the files touched in the data directory
+ * from now on, so once every file is valid, the next
+ * validation only has to hash the ones touched since.
+ */
+void Updater::watch(const QString &root) {
+    watcher.watch(root);
+}
+
+/*
+ * Validate a manifest, and download the files that fail.
+ * Files that haven't changed since they were last validated
+ * are skipped, unless forced. A manifest given while another
+ * is still being updated takes its place.
+ */
+void Updater::update(Manifest *manifest, bool force) {
+
+    // A background update gives way, and is picked up again later.
+    if(background && !pending.isEmpty() && this->manifest->checksum != manifest->checksum)
+        backlog.prepend(this->manifest);
+
+    run(manifest, force, false);
+
+}
+
+/*
+ * Queue a manifest to be updated in the background, once
+ * nothing else is. Its files are hashed at idle priority,
+ * and don't count towards the progress shown.
+ */
+void Updater::prefetch(Manifest *manifest) {
+
+    for(Manifest *queued : backlog)
+        if(queued->checksum == manifest->checksum)
+            return;
+    if(background && !pending.isEmpty() && this->manifest->checksum == manifest->checksum)
+        return;
+
+    backlog.enqueue(manifest);
+    next();
+
+}
+
+/*
+ * Hold background updates back, such as while a game is
+ * running. Updates the user asked for carry on.
+ */
+void Updater::setPaused(bool paused) {
+
+    qInfo() << (paused ? "pausing" : "resuming") << " background updates";
+    this->paused = paused;
+    validator.setPaused(paused);
+    if(!paused)
+        resumeDeferred();
+
+}
+
+void Updater::next() {
+    if(pending.isEmpty() && !backlog.isEmpty())
+        run(backlog.dequeue(), false, true);
+}
+
+ProgressTracker &Updater::tracker() {
+    return background ? idleProgress : progress;
+}
+
+void Updater::run(Manifest *manifest, bool force, bool background) {
+
+    if(!pending.isEmpty())
+        supersede(manifest, force);
+
+    int run = ++runs;
+    this->manifest = manifest;
+    this->background = background;
+    currentFiles = 0;
+    errorFiles.clear();
+    maxFiles = manifest->items.size();
+    pending.clear();
+    pending.reserve(manifest->items.size());
+    for(ManifestItem *item : manifest->items)
+        pending[key(item)]++;
+    tracker().reset(maxFiles, 0);
+
+    // Downloads held back for a background update may be needed now.
+    if(!background)
+        resumeDeferred();
+
+    /*
+     * Files no one touched since the last clean validation
+     * are still valid, if every touch since was seen.
+     */
+    QSet<QString> touched;
+    bool watched = watcher.take(touched) && watchedClean;
+    watchedClean = false;
+
+    if(maxFiles == 0) {
+        finish();
+        return;
+    }
+
+    if(force) {
+        for(ManifestItem *item : manifest->items)
+            tracker().expect(item->size);
+        start(manifest->items, true);
+        return;
+    }
+
+    /*
+     * Otherwise, compare the manifest to the last one that
+     * validated cleanly, and validate only the files that
+     * changed in it or on disk since. The one saved to disk
+     * is only used until one validates in this session, since
+     * it may still be being written.
+     */
+    if(watched)
+        qInfo() << touched.size() << " paths touched since the last validation";
+    Manifest *validated = this->validated;
+    QFutureWatcher<QList<ManifestItem*>> *watcher = new QFutureWatcher<QList<ManifestItem*>>(this);
+    connect(watcher, &QFutureWatcher<QList<ManifestItem*>>::finished, [=] {
+
+        watcher->deleteLater();
+
+        // Another manifest took this one's place meanwhile.
+        if(run != runs)
+            return;
+
+        QList<ManifestItem*> changed = watcher->result();
+        qInfo() << changed.size() << " of " << maxFiles << " files to validate";
+
+        QSet<WorkKey> needed;
+        needed.reserve(changed.size());
+        for(ManifestItem *item : changed) {
+            needed.insert(key(item));
+            tracker().expect(item->size);
+        }
+
+        qint64 unchanged = 0;
+        for(ManifestItem *item : manifest->items) {
+            WorkKey k = key(item);
+            if(!needed.contains(k))
+                unchanged += pending.take(k);
+        }
+        currentFiles += unchanged;
+        tracker().addFiles(unchanged);
+
+        if(pending.isEmpty())
+            finish();
+        else
+            start(changed, false);
+
+    });
+    watcher->setFuture(QtConcurrent::run([=] {
+        QScopedPointer<Manifest> loaded(validated ? nullptr : ManifestCache::loadValidated());
+        Manifest *previous = validated ? validated : loaded.data();
+        return previous
+                ? manifest->changedSince(previous, &cache, watched ? &touched : nullptr)
+                : manifest->items;
+    }));
+
+}
+
+/*
+ * Check, without hashing anything, whether every file
+ * is unchanged since it was last validated. This can be
+ * called from any thread.
+ */
+bool Updater::isCached(Manifest *manifest) {
+    return manifest->isCached(&cache);
+}
+
+/*
+ * Two items are the same work if they put the same
+ * contents at the same path, whichever manifest they
+ * come from.
+ */
+Updater::WorkKey Updater::key(const ManifestItem *item) {
+    return qMakePair(item->fname(), item->digest());
+}
+
+/*
+ * Hand the work in flight over to the manifest taking the
+ * current one's place. Files it also needs carry on and count
+ * for it instead, and ones queued in the background are queued
+ * again at full priority. The rest are cancelled, unless they
+ * already started, in which case their results are only recorded.
+ */
+void Updater::supersede(Manifest *next, bool force) {
+
+    QHash<WorkKey, ManifestItem*> wanted;
+    wanted.reserve(next->items.size());
+    for(ManifestItem *item : next->items)
+        wanted.insert(key(item), item);
+
+    int kept = 0;
+    int cancelled = 0;
+    QList<ManifestItem*> raised;
+    for(auto it = work.begin(); it != work.end(); ) {
+        ManifestItem *target = wanted.value(it.key());
+        if(target) {
+            if(background && validator.cancel(it.value().item)) {
+                it.value().item = target;
+                raised.append(target);
+            }
+            it.value().target = target;
+            kept++;
+            ++it;
+            continue;
+        }
+
+        validator.cancel(it.value().item);
+        if(FileDownload *download = downloads.value(it.key()))
+            download->cancel();
+        downloadAttempts.remove(it.key());
+        it = work.erase(it);
+        cancelled++;
+    }
+
+    if(!raised.isEmpty())
+        validator.validate(raised, force, ValidationScheduler::Foreground);
+
+    qInfo() << "switched manifests, kept " << kept << " and cancelled " << cancelled << " files in flight";
+
+}
+
+/*
+ * Queue files for validation, except the ones already
+ * being worked on, and ones this build can't check.
+ */
+void Updater::start(const QList<ManifestItem*> &items, bool force) {
+
+    QList<ManifestItem*> queue;
+    for(ManifestItem *item : items) {
+        if(!ContentHash::isSupported(item->algorithm)) {
+            failItem(item, item->fname() + ": this build can't check " + ContentHash::name(item->algorithm));
+            continue;
+        }
+
+        WorkKey k = key(item);
+        if(work.contains(k))
+            continue;
+        work.insert(k, Work{item, item});
+        queue.append(item);
+    }
+
+    if(!queue.isEmpty())
+        validator.validate(queue, force, background ? ValidationScheduler::Background : ValidationScheduler::Foreground);
+
+}
+
+/*
+ * Count a file that finished validating, or
+ * download it if it's missing or corrupt.
+ */
+void Updater::itemValidated(ManifestItem *item, bool valid) {
+
+    // Work that was cancelled after it started.
+    WorkKey k = key(item);
+    auto it = work.constFind(k);
+    if(it == work.constEnd())
+        return;
+    ManifestItem *target = it.value().target;
+
+    if(valid) {
+        qDebug() << target->fname() + " validated";
+        work.remove(k);
+        store.checkin(target, false, this, [=](bool replaced) {
+            if(replaced)
+                watcher.ignore(target->fname());
+            countItem(target);
+        });
+        return;
+    }
+
+    // Another manifest may have stored the same contents.
+    store.checkout(target, this, [=](bool placed) {
+        auto it = work.constFind(k);
+        if(it == work.constEnd())
+            return;
+        ManifestItem *current = it.value().target;
+
+        if(!placed) {
+            downloadItem(current);
+            return;
+        }
+        work.remove(k);
+        watcher.ignore(current->fname());
+        countItem(current);
+    });
+
+}
+
+/*
+ * Download a file in the given manifest, and
+ * validate it again once it's written.
+ */
+void Updater::downloadItem(ManifestItem *item) {
+
+    WorkKey k = key(item);
+
+    /*
+     * Give up on a file once every mirror had its chance and
+     * a few retries were spent, rather than on the first
+     * failure from each mirror. A file only found in a pack
+     * spends its retries on the pack.
+     */
+    QSettings settings;
+    bool packed = item->isPacked() && (item->urlCount() == 0 || !downloadAttempts.contains(k));
+    int maxAttempts = qMax(item->urlCount(), settings.value("downloadAttempts", 5).toInt());
+    if((!packed && item->urlCount() == 0) || downloadAttempts.value(k) >= maxAttempts) {
+        qWarning() << "failed to download " << item->fname();
+        work.remove(k);
+        downloadAttempts.remove(k);
+        failItem(item, item->urlCount() == 0
+                 ? item->fname() + " has no URL this launcher can download it from"
+                 : item->fname() + " failed to download");
+        return;
+    }
+
+    // Background downloads wait while a game is running.
+    if(background && paused) {
+        deferred.append(k);
+        return;
+    }
+
+    /*
+     * A file in a pack is first fetched from it, along with
+     * the other files that fail validation around the same
+     * time. If that fails, it's downloaded on its own.
+     */
+    if(packed) {
+        work[k].item = item;
+        downloadAttempts[k]++;
+        tracker().expect(item->size);
+        packQueue.append(k);
+        if(!packTimer.isActive())
+            packTimer.start();
+        return;
+    }
+
+    /*
+     * Wait for a mirror to come out of back off
+     * if all of them failed recently.
+     */
+    QList<QUrl> urls = item->urls();
+    QList<QUrl> mirrors = mirrorScores.rank(urls, item->size);
+    if(mirrors.isEmpty()) {
+        qint64 wait = mirrorScores.retryAt(urls) - QDateTime::currentMSecsSinceEpoch();
+        QTimer::singleShot(int(qMax(wait, qint64(0))), this, [=] {
+            auto it = work.constFind(k);
+            if(it != work.constEnd())
+                downloadItem(it.value().target);
+        });
+        return;
+    }
+
+    work[k].item = item;
+    downloadAttempts[k]++;
+    tracker().expect(item->size);
+
+    /*
+     * Large files with more than one mirror are
+     * downloaded from all of the mirrors at once,
+     * unless the mirrors serve them compressed.
+     */
+    if(mirrors.size() > 1
+            && item->encoding == StreamDecoder::Identity
+            && item->size >= settings.value("segmentThreshold", 64 << 20).toLongLong()) {
+        SegmentedDownload *download = new SegmentedDownload(item, mirrors, netMan, &transfers, &mirrorScores, &tracker(), this);
+        connect (
+            download,
+            &SegmentedDownload::finished,
+            [=](bool valid) {
+               download->deleteLater();
+               itemDownloaded(item, valid);
+            });
+        download->start();
+        return;
+    }
+
+    // Otherwise, download it from the best mirror.
+    FileDownload *download = new FileDownload(item, mirrors.first(), netMan, &transfers, &mirrorScores, &tracker(), this);
+    downloads.insert(k, download);
+    connect (
+        download,
+        &FileDownload::finished,
+        [=](bool valid) {
+           download->deleteLater();
+           if(downloads.value(k) == download)
+               downloads.remove(k);
+           itemDownloaded(item, valid);
+        });
+    download->start();
+
+}
+
+/*
+ * Fetch the files gathered for their packs, with one
+ * download for each pack.
+ */
+void Updater::downloadPacks() {
+
+    QList<WorkKey> keys;
+    keys.swap(packQueue);
+    QHash<QString, QList<ManifestItem*>> packs;
+    for(const WorkKey &k : keys) {
+        auto it = work.constFind(k);
+        if(it == work.constEnd())
+            continue;
+
+        // The manifest that took over may not keep the file in a pack.
+        ManifestItem *item = it.value().item;
+        if(!item->isPacked()) {
+            downloadItem(it.value().target);
+            continue;
+        }
+        packs[item->packUrls().first().toString()].append(item);
+    }
+
+    for(const QList<ManifestItem*> &items : packs) {
+        qint64 size = 0;
+        for(ManifestItem *item : items)
+            size += item->size;
+
+        /*
+         * Files whose pack can't be fetched right now are
+         * downloaded on their own. Those only found in the
+         * pack wait for a mirror to come out of back off.
+         */
+        QList<QUrl> packUrls = items.first()->packUrls();
+        QList<QUrl> mirrors = mirrorScores.rank(packUrls, size);
+        if(mirrors.isEmpty()) {
+            QList<WorkKey> waiting;
+            for(ManifestItem *item : items) {
+                if(item->urlCount() == 0)
+                    waiting.append(key(item));
+                else
+                    itemDownloaded(item, false);
+            }
+            if(waiting.isEmpty())
+                continue;
+
+            qint64 wait = mirrorScores.retryAt(packUrls) - QDateTime::currentMSecsSinceEpoch();
+            QTimer::singleShot(int(qMax(wait, qint64(0))), this, [=] {
+                packQueue.append(waiting);
+                if(!packTimer.isActive())
+                    packTimer.start();
+            });
+            continue;
+        }
+
+        PackDownload *download = new PackDownload(items, mirrors, netMan, &transfers, &mirrorScores, &tracker(), this);
+        connect (
+            download,
+            &PackDownload::unpacked,
+            this,
+            &Updater::itemDownloaded);
+        connect (
+            download,
+            &PackDownload::finished,
+            download,
+            &QObject::deleteLater);
+        download->start();
+    }
+
+}
+
+/*
+ * Count a downloaded file, or try another mirror if
+ * the download failed. A good download was already
+ * hashed, so it's not validated again. One that's no
+ * longer needed is kept if it's good.
+ */
+void Updater::itemDownloaded(ManifestItem *item, bool valid) {
+
+    WorkKey k = key(item);
+    auto it = work.constFind(k);
+    if(it == work.constEnd()) {
+        if(valid) {
+            item->markValid(&cache);
+            watcher.ignore(item->fname());
+            store.checkin(item, true, this, [=](bool replaced) {
+                if(replaced)
+                    watcher.ignore(item->fname());
+            });
+        }
+        return;
+    }
+    ManifestItem *target = it.value().target;
+
+    if(!valid) {
+        downloadItem(target);
+        return;
+    }
+
+    work.remove(k);
+    downloadAttempts.remove(k);
+    target->markValid(&cache);
+    watcher.ignore(target->fname());
+    store.checkin(target, true, this, [=](bool replaced) {
+        if(replaced)
+            watcher.ignore(target->fname());
+        countItem(target);
+    });
+
+}
+
+/*
+ * Count a file, along with any other item in the manifest
+ * that puts the same contents at the same path, since the
+ * work for them all was only done once.
+ */
+void Updater::countItem(ManifestItem *item) {
+
+    int count = pending.take(key(item));
+    if(count == 0)
+        return;
+
+    currentFiles += count;
+    tracker().addFiles(count);
+    if(pending.isEmpty())
+        finish();
+
+}
+
+void Updater::failItem(ManifestItem *item, const QString &error) {
+
+    int count = pending.take(key(item));
+    if(count == 0)
+        return;
+
+    for(int i = 0; i < count; i++)
+        errorFiles.append(error);
+    if(pending.isEmpty())
+        finish();
+
+}
+
+/*
+ * Called once every file in the manifest has
+ * either been validated or failed.
+ */
+void Updater::finish() {
+
+    qInfo() << "last file";
+    tracker().stop();
+
+    // Remember what was validated so it isn't hashed again.
+    cache.save();
+    mirrorScores.save();
+
+    /*
+     * Keep the manifest every file is now valid against,
+     * so the next validation only checks what changed.
+     */
+    watchedClean = errorFiles.isEmpty();
+    if(errorFiles.isEmpty()) {
+        validated = manifest;
+        Manifest *saved = manifest;
+        QtConcurrent::run([=] {
+            ManifestCache::saveValidated(saved);
+        });
+    }
+
+    if(background)
+        emit prefetched(manifest, errorFiles.isEmpty());
+    else
+        emit finished(errorFiles);
+
+    // Carry on with the manifests waiting in the background.
+    QTimer::singleShot(0, this, &Updater::next);
+
+}
+
+/*
+ * Start the downloads that were held back, if
+ * they're still needed.
+ */
+void Updater::resumeDeferred() {
+
+    QList<WorkKey> keys;
+    keys.swap(deferred);
+    for(const WorkKey &k : keys) {
+        auto it = work.constFind(k);
+        if(it != work.constEnd())
+            downloadItem(it.value().target);
+    }
+
+}
@@ -0,0 +1,113 @@
+#ifndef UPDATER_H
+#define UPDATER_H
+
+#include "manifest.h"
+#include "manifestitem.h"
+#include "validationcache.h"
+#include "validationscheduler.h"
+#include "mirrorscoreboard.h"
+#include "transferscheduler.h"
+#include "progresstracker.h"
+#include "filewatcher.h"
+#include "objectstore.h"
+
+#include <QObject>
+#include <QNetworkAccessManager>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <QQueue>
+#include <QTimer>
+
+class FileDownload;
+
+/*
+ * Validates every file in a manifest and downloads the ones
+ * that are missing or corrupt. It has no user interface of
+ * its own, so both the window and headless mode use it.
+ *
+ * All hashing and downloading in flight is kept by path and
+ * digest, so a file is never worked on twice at once, and
+ * work carries over when another manifest takes the place
+ * of the one being updated. Manifests can also be updated in
+ * the background, at idle priority, while nothing else is.
+ * Small files stored in packs are downloaded together, a
+ * pack at a time.
+ */
+class Updater : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Updater(QNetworkAccessManager *netMan, QObject *parent = nullptr);
+    void configure();
+    void watch(const QString &root);
+    void update(Manifest *manifest, bool force);
+    void prefetch(Manifest *manifest);
+    void setPaused(bool paused);
+    bool isCached(Manifest *manifest);
+
+    long currentFiles;
+    long maxFiles;
+    QStringList errorFiles;
+    ProgressTracker progress;
+
+signals:
+    void finished(const QStringList &errors);
+    void prefetched(Manifest *manifest, bool valid);
+
+private:
+    typedef QPair<QString, QByteArray> WorkKey;
+
+    /*
+     * A file being hashed or downloaded: the item the work
+     * was started for, and the one it now counts for, which
+     * may be from the manifest that took its place.
+     */
+    struct Work {
+        ManifestItem *item;
+        ManifestItem *target;
+    };
+
+    QNetworkAccessManager *netMan;
+    Manifest *manifest;
+    Manifest *validated;
+    ValidationCache cache;
+    ObjectStore store;
+    ValidationScheduler validator;
+    MirrorScoreboard mirrorScores;
+    TransferScheduler transfers;
+    QHash<WorkKey, Work> work;
+    QHash<WorkKey, FileDownload*> downloads;
+    QHash<WorkKey, int> downloadAttempts;
+    // Files not yet counted, and how many items in the manifest share each.
+    QHash<WorkKey, int> pending;
+    int runs;
+    bool background;
+    bool paused;
+    QQueue<Manifest*> backlog;
+    QList<WorkKey> deferred;
+    QList<WorkKey> packQueue;
+    QTimer packTimer;
+    ProgressTracker idleProgress;
+    FileWatcher watcher;
+    bool watchedClean;
+
+    static WorkKey key(const ManifestItem *item);
+    ProgressTracker &tracker();
+    void run(Manifest *manifest, bool force, bool background);
+    void next();
+    void resumeDeferred();
+    void supersede(Manifest *next, bool force);
+    void start(const QList<ManifestItem*> &items, bool force);
+    void itemValidated(ManifestItem *item, bool valid);
+    void downloadItem(ManifestItem *item);
+    void downloadPacks();
+    void itemDownloaded(ManifestItem *item, bool valid);
+    void countItem(ManifestItem *item);
+    void failItem(ManifestItem *item, const QString &error);
+    void finish();
+
+};
+
+#endif // UPDATER_H
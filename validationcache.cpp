@@ -0,0 +1,174 @@
+#include "validationcache.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDir>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+static const quint32 CACHE_MAGIC = 0x53545643; // "STVC"
+static const quint32 CACHE_VERSION = 1;
+
+ValidationCache::ValidationCache(QString fname, QObject *parent)
+    : QObject(parent),
+      fname(fname),
+      dirty(false) {}
+
+/*
+ * Read the cache from disk. A missing or unreadable
+ * cache is the same as an empty one.
+ */
+bool ValidationCache::load() {
+
+    QMutexLocker lock(&mutex);
+    entries.clear();
+    dirty = false;
+
+    QFile file(fname);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic, version, count;
+    in >> magic >> version >> count;
+    if(magic != CACHE_MAGIC || version != CACHE_VERSION) {
+        qWarning() << "ignoring incompatible validation cache: " << fname;
+        return false;
+    }
+
+    entries.reserve(count);
+    for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        QString path;
+        Entry entry;
+        in >> path >> entry.size >> entry.mtime >> entry.inode >> entry.device >> entry.digest;
+        entries.insert(path, entry);
+    }
+
+    if(in.status() != QDataStream::Ok) {
+        qWarning() << "corrupt validation cache: " << fname;
+        entries.clear();
+        return false;
+    }
+
+    return true;
+
+}
+
+/*
+ * Write the cache to disk if anything changed since
+ * it was loaded.
+ */
+bool ValidationCache::save() {
+
+    QMutexLocker lock(&mutex);
+    if(!dirty)
+        return true;
+
+    QFileInfo(fname).dir().mkpath(".");
+    QSaveFile file(fname);
+    if(!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "unable to write validation cache: " << fname;
+        return false;
+    }
+
+    QDataStream out(&file);
+    out << CACHE_MAGIC << CACHE_VERSION << quint32(entries.size());
+    for(auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        const Entry &entry = it.value();
+        out << it.key() << entry.size << entry.mtime << entry.inode << entry.device << entry.digest;
+    }
+
+    if(!file.commit())
+        return false;
+
+    dirty = false;
+    return true;
+
+}
+
+/*
+ * Check whether a file was already validated against the
+ * given digest and hasn't been touched since.
+ */
+bool ValidationCache::matches(const QString &fname, const Entry &stamp) {
+
+    QMutexLocker lock(&mutex);
+    auto it = entries.constFind(key(fname));
+    if(it == entries.constEnd())
+        return false;
+
+    const Entry &entry = it.value();
+    return entry.size == stamp.size
+            && entry.mtime == stamp.mtime
+            && entry.inode == stamp.inode
+            && entry.device == stamp.device
+            && entry.digest == stamp.digest;
+
+}
+
+/*
+ * Check whether the contents last validated at a path had
+ * the given digest, without looking at the file itself.
+ */
+bool ValidationCache::matches(const QString &fname, const QByteArray &digest) {
+    QMutexLocker lock(&mutex);
+    auto it = entries.constFind(key(fname));
+    return it != entries.constEnd() && it.value().digest == digest;
+}
+
+void ValidationCache::insert(const QString &fname, const Entry &stamp) {
+    QMutexLocker lock(&mutex);
+    entries.insert(key(fname), stamp);
+    dirty = true;
+}
+
+void ValidationCache::remove(const QString &fname) {
+    QMutexLocker lock(&mutex);
+    if(entries.remove(key(fname)))
+        dirty = true;
+}
+
+/*
+ * Read the metadata used to tell whether a file changed.
+ * The digest is left for the caller to fill in.
+ */
+bool ValidationCache::stat(const QString &fname, Entry &stamp) {
+
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if(::stat(QFile::encodeName(fname).constData(), &st) != 0)
+        return false;
+    stamp.size = st.st_size;
+#ifdef Q_OS_LINUX
+    stamp.mtime = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#else
+    stamp.mtime = qint64(st.st_mtime) * 1000000000;
+#endif
+    stamp.inode = st.st_ino;
+    stamp.device = st.st_dev;
+#else
+    QFileInfo info(fname);
+    if(!info.exists())
+        return false;
+    stamp.size = info.size();
+    stamp.mtime = info.lastModified().toMSecsSinceEpoch() * 1000000;
+    stamp.inode = 0;
+    stamp.device = 0;
+#endif
+
+    return true;
+
+}
+
+/*
+ * Files are keyed by absolute path, so entries from
+ * different data directories never collide.
+ */
+QString ValidationCache::key(const QString &fname) {
+    return QDir::cleanPath(QDir::current().absoluteFilePath(fname));
+}
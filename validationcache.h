@@ -0,0 +1,44 @@
+#ifndef VALIDATIONCACHE_H
+#define VALIDATIONCACHE_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+
+/*
+ * A record of files that were hashed and found valid,
+ * so files that haven't changed since are not hashed again.
+ */
+class ValidationCache : public QObject
+{
+    Q_OBJECT
+public:
+    struct Entry {
+        qint64 size = -1;
+        qint64 mtime = 0;
+        quint64 inode = 0;
+        quint64 device = 0;
+        QByteArray digest;
+    };
+
+    explicit ValidationCache(QString fname, QObject *parent = nullptr);
+    bool load();
+    bool save();
+    bool matches(const QString &fname, const Entry &stamp);
+    bool matches(const QString &fname, const QByteArray &digest);
+    void insert(const QString &fname, const Entry &stamp);
+    void remove(const QString &fname);
+
+    static bool stat(const QString &fname, Entry &stamp);
+
+private:
+    static QString key(const QString &fname);
+
+    QString fname;
+    QHash<QString, Entry> entries;
+    QMutex mutex;
+    bool dirty;
+
+};
+
+#endif // VALIDATIONCACHE_H
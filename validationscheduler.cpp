@@ -0,0 +1,334 @@
+#include "validationscheduler.h"
+#include "metrics.h"
+
+#include <QRunnable>
+#include <QVector>
+#include <QStorageInfo>
+#include <QSettings>
+#include <QFileInfo>
+#include <QThread>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// From linux/ioprio.h, which glibc doesn't wrap.
+static const int IOPRIO_WHO_PROCESS = 1;
+static const int IOPRIO_CLASS_IDLE = 3;
+static const int IOPRIO_CLASS_SHIFT = 13;
+#endif
+
+#ifdef Q_OS_WIN
+#include <qt_windows.h>
+#endif
+
+/*
+ * Let the calling thread run and read from disk only when
+ * nothing else wants to. Without privileges it can't be raised
+ * again, which is why background files get a pool of their own.
+ */
+static void lowerThreadPriority() {
+
+#ifdef Q_OS_LINUX
+    struct sched_param param = {};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#elif defined(Q_OS_WIN)
+    // Lowers the thread's I/O priority along with its CPU priority.
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#endif
+
+}
+
+/*
+ * Hash a single file on a pool thread. The result is
+ * delivered through a signal, which is queued to the
+ * scheduler's thread. A file that was cancelled while
+ * it was queued is skipped.
+ */
+class ValidationTask : public QRunnable
+{
+public:
+    ValidationTask (
+            ValidationScheduler *scheduler,
+            ValidationCache *cache,
+            ProgressTracker *progress,
+            ManifestItem *item,
+            quint64 ticket,
+            bool force,
+            bool background )
+        : scheduler(scheduler),
+          cache(cache),
+          progress(progress),
+          item(item),
+          ticket(ticket),
+          force(force),
+          background(background),
+          queued(Metrics::now()) {}
+
+    void run() override {
+        if(background) {
+            lowerThreadPriority();
+            scheduler->waitWhilePaused();
+        }
+        Metrics::record("queue", "validation", queued);
+        if(!scheduler->claim(item, ticket))
+            return;
+        emit scheduler->validated(item, item->validate(cache, force, progress));
+    }
+
+private:
+    ValidationScheduler *scheduler;
+    ValidationCache *cache;
+    ProgressTracker *progress;
+    ManifestItem *item;
+    quint64 ticket;
+    bool force;
+    bool background;
+    qint64 queued;
+
+};
+
+/*
+ * Queue files in the order of their inodes, which on most file
+ * systems roughly follows where they are on disk. Reading in
+ * that order avoids seeking back and forth on spinning disks.
+ * This runs on the pool, since it has to stat every file.
+ */
+class LayoutOrderTask : public QRunnable
+{
+public:
+    LayoutOrderTask (
+            ValidationScheduler *scheduler,
+            QThreadPool *pool,
+            ValidationCache *cache,
+            ProgressTracker *progress,
+            QList<QPair<ManifestItem*, quint64>> items,
+            bool force,
+            int priority )
+        : scheduler(scheduler),
+          pool(pool),
+          cache(cache),
+          progress(progress),
+          items(items),
+          force(force),
+          priority(priority) {}
+
+    void run() override {
+
+        if(priority == ValidationScheduler::Background)
+            lowerThreadPriority();
+
+        QVector<QPair<quint64, int>> order;
+        order.reserve(items.size());
+        for(int i = 0; i < items.size(); i++) {
+            ValidationCache::Entry stamp;
+            ValidationCache::stat(items[i].first->fname(), stamp);
+            order.append(qMakePair(stamp.inode, i));
+        }
+
+        std::stable_sort(order.begin(), order.end(), [](const QPair<quint64, int> &a, const QPair<quint64, int> &b) {
+            return a.first < b.first;
+        });
+
+        for(const QPair<quint64, int> &entry : order) {
+            const QPair<ManifestItem*, quint64> &item = items[entry.second];
+            pool->start(new ValidationTask (
+                            scheduler,
+                            cache,
+                            progress,
+                            item.first,
+                            item.second,
+                            force,
+                            priority == ValidationScheduler::Background ), priority);
+        }
+
+    }
+
+private:
+    ValidationScheduler *scheduler;
+    QThreadPool *pool;
+    ValidationCache *cache;
+    ProgressTracker *progress;
+    QList<QPair<ManifestItem*, quint64>> items;
+    bool force;
+    int priority;
+
+};
+
+ValidationScheduler::ValidationScheduler(ValidationCache *cache, ProgressTracker *progress, QObject *parent)
+    : QObject(parent),
+      cache(cache),
+      progress(progress),
+      nextTicket(0),
+      paused(false) {
+
+    // Items are passed from the pool's threads by pointer.
+    qRegisterMetaType<ManifestItem*>();
+
+    idlePool.setMaxThreadCount(1);
+
+}
+
+ValidationScheduler::~ValidationScheduler() {
+    setPaused(false);
+    pool.clear();
+    idlePool.clear();
+    pool.waitForDone();
+    idlePool.waitForDone();
+}
+
+/*
+ * Queue every file of a manifest for validation, ahead
+ * of any queued files of a lower priority.
+ */
+void ValidationScheduler::validate(QList<ManifestItem*> items, bool force, Priority priority) {
+
+    /*
+     * Background files don't count towards the progress
+     * shown, and never hold up anything else.
+     */
+    if(priority == Background) {
+        QList<QPair<ManifestItem*, quint64>> tasks;
+        tasks.reserve(items.size());
+        for(ManifestItem *item : items)
+            tasks.append(qMakePair(item, issue(item)));
+        idlePool.start(new LayoutOrderTask(this, &idlePool, cache, nullptr, tasks, force, priority));
+        return;
+    }
+
+    /*
+     * Spinning disks slow down when several files are read
+     * at once, so they get fewer workers than solid state
+     * disks do.
+     */
+    QSettings settings;
+    bool rotational = isRotational(QDir::currentPath());
+    int threads = rotational
+            ? settings.value("hashThreadsHdd", 1).toInt()
+            : settings.value("hashThreadsSsd", QThread::idealThreadCount()).toInt();
+    pool.setMaxThreadCount(qMax(1, threads));
+    qInfo() << "validating with" << pool.maxThreadCount() << "threads";
+
+    if(rotational) {
+        QList<QPair<ManifestItem*, quint64>> tasks;
+        tasks.reserve(items.size());
+        for(ManifestItem *item : items)
+            tasks.append(qMakePair(item, issue(item)));
+        pool.start(new LayoutOrderTask(this, &pool, cache, progress, tasks, force, priority), priority);
+        return;
+    }
+
+    /*
+     * Start the largest files first, so one huge file at the end
+     * doesn't leave the other workers idle, and the small files
+     * fill in the gaps.
+     */
+    std::stable_sort(items.begin(), items.end(), [](ManifestItem *a, ManifestItem *b) {
+        return a->size > b->size;
+    });
+
+    for(ManifestItem *item : items)
+        pool.start(new ValidationTask(this, cache, progress, item, issue(item), force, false), priority);
+
+}
+
+/*
+ * Queue a single file ahead of the rest, such
+ * as one that was just downloaded.
+ */
+void ValidationScheduler::validate(ManifestItem *item, bool force) {
+    pool.start(new ValidationTask(this, cache, progress, item, issue(item), force, false), Urgent);
+}
+
+/*
+ * Drop every file that hasn't started validating yet.
+ */
+void ValidationScheduler::cancel() {
+    pool.clear();
+    idlePool.clear();
+    QMutexLocker lock(&mutex);
+    tickets.clear();
+}
+
+/*
+ * Drop a file if it hasn't started validating yet, and
+ * return whether it was dropped. One that has started
+ * still reports its result.
+ */
+bool ValidationScheduler::cancel(ManifestItem *item) {
+    QMutexLocker lock(&mutex);
+    return tickets.remove(item) > 0;
+}
+
+/*
+ * Called by a task as it starts. Only the task holding the
+ * latest ticket for a file that wasn't cancelled may run.
+ */
+bool ValidationScheduler::claim(ManifestItem *item, quint64 ticket) {
+
+    QMutexLocker lock(&mutex);
+    auto it = tickets.find(item);
+    if(it == tickets.end() || it.value() != ticket)
+        return false;
+    tickets.erase(it);
+    return true;
+
+}
+
+/*
+ * Hold background files back, such as while a game is
+ * running. Files that already started are finished.
+ */
+void ValidationScheduler::setPaused(bool paused) {
+    QMutexLocker lock(&mutex);
+    this->paused = paused;
+    if(!paused)
+        resumed.wakeAll();
+}
+
+void ValidationScheduler::waitWhilePaused() {
+    QMutexLocker lock(&mutex);
+    while(paused)
+        resumed.wait(&mutex);
+}
+
+quint64 ValidationScheduler::issue(ManifestItem *item) {
+    QMutexLocker lock(&mutex);
+    tickets.insert(item, ++nextTicket);
+    return nextTicket;
+}
+
+/*
+ * Check whether a path is stored on a spinning disk. When
+ * this can't be determined, the disk is assumed to be solid
+ * state.
+ */
+bool ValidationScheduler::isRotational(const QString &path) {
+
+#ifdef Q_OS_LINUX
+    QString device = QFileInfo(QString(QStorageInfo(path).device())).fileName();
+    if(device.isEmpty())
+        return false;
+
+    // Partitions don't have a queue, but the disk they're on does.
+    QString sys = QFileInfo("/sys/class/block/" + device).canonicalFilePath();
+    for(QString dir : {sys, QFileInfo(sys).path()}) {
+        QFile file(dir + "/queue/rotational");
+        if(file.open(QIODevice::ReadOnly))
+            return file.readAll().trimmed() == "1";
+    }
+#else
+    Q_UNUSED(path)
+#endif
+
+    return false;
+
+}
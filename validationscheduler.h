@@ -0,0 +1,62 @@
+#ifndef VALIDATIONSCHEDULER_H
+#define VALIDATIONSCHEDULER_H
+
+#include "manifestitem.h"
+#include "validationcache.h"
+#include "progresstracker.h"
+
+#include <QObject>
+#include <QThreadPool>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QHash>
+
+/*
+ * Hashes manifest files on a dedicated, bounded thread pool.
+ * The number of workers depends on whether the data directory
+ * is on a solid state or a spinning disk. Background files are
+ * hashed one at a time on a pool of their own, at idle CPU and
+ * I/O priority, and can be paused.
+ */
+class ValidationScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    // Queued files of a higher priority are hashed first.
+    enum Priority {
+        Background,
+        Foreground,
+        Urgent
+    };
+
+    explicit ValidationScheduler(ValidationCache *cache, ProgressTracker *progress = nullptr, QObject *parent = nullptr);
+    ~ValidationScheduler();
+    void validate(QList<ManifestItem*> items, bool force, Priority priority = Foreground);
+    void validate(ManifestItem *item, bool force);
+    void cancel();
+    bool cancel(ManifestItem *item);
+    bool claim(ManifestItem *item, quint64 ticket);
+    void setPaused(bool paused);
+    void waitWhilePaused();
+
+    static bool isRotational(const QString &path);
+
+signals:
+    void validated(ManifestItem *item, bool valid);
+
+private:
+    QThreadPool pool;
+    QThreadPool idlePool;
+    ValidationCache *cache;
+    ProgressTracker *progress;
+    QHash<ManifestItem*, quint64> tickets;
+    quint64 nextTicket;
+    QMutex mutex;
+    bool paused;
+    QWaitCondition resumed;
+
+    quint64 issue(ManifestItem *item);
+
+};
+
+#endif // VALIDATIONSCHEDULER_H